@@ -0,0 +1,137 @@
+// Write and read throughput of SqliteDb with cached prepared statements,
+// against preparing and finalizing a statement on every call as SqliteDb
+// did before. Build and run with `make bench`; optional arg: ops per run.
+#include "persistence/sqlite_db.hpp"
+
+#include <sqlite3.h>
+#include <msgpack.hpp>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static const char* DB_PATH = "db_bench.db";
+
+static vector<ShoppingList> make_lists(size_t n) {
+    vector<ShoppingList> lists;
+    lists.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+        ShoppingList list("list-" + to_string(i), "bench");
+        list.add("bench", ShoppingItem("bench", "item-" + to_string(i), "milk", 2, 0));
+        lists.push_back(move(list));
+    }
+    return lists;
+}
+
+static void remove_db() {
+    for (const char* suffix : {"", "-wal", "-shm"})
+        remove((string(DB_PATH) + suffix).c_str());
+}
+
+template <typename F>
+static double ops_per_sec(size_t ops, F&& body) {
+    auto start = chrono::steady_clock::now();
+    body();
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return ops / secs;
+}
+
+// The old write and read paths: one prepare and finalize per call
+struct UncachedDb {
+    sqlite3* db = nullptr;
+
+    bool open() {
+        if (sqlite3_open(DB_PATH, &db) != SQLITE_OK) return false;
+        const char* sql =
+            "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;"
+            "CREATE TABLE IF NOT EXISTS lists (id TEXT PRIMARY KEY, data BLOB NOT NULL, "
+            "hash INTEGER NOT NULL DEFAULT 0, seq INTEGER NOT NULL DEFAULT 0);";
+        return sqlite3_exec(db, sql, nullptr, nullptr, nullptr) == SQLITE_OK;
+    }
+
+    ~UncachedDb() {
+        if (db) sqlite3_close(db);
+    }
+
+    bool write(const ShoppingList& list) {
+        msgpack::sbuffer buffer;
+        msgpack::pack(buffer, list);
+
+        sqlite3_stmt* stmt;
+        const char* sql = "INSERT OR REPLACE INTO lists (id, data, hash, seq) VALUES (?, ?, ?, ?);";
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) return false;
+        sqlite3_bind_text(stmt, 1, list.getUid().c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_blob(stmt, 2, buffer.data(), buffer.size(), SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt, 3, static_cast<sqlite3_int64>(list.digest()));
+        sqlite3_bind_int64(stmt, 4, 0);
+        bool ok = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_finalize(stmt);
+        return ok;
+    }
+
+    bool read(const string& listId) {
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(db, "SELECT data FROM lists WHERE id = ?;", -1, &stmt, nullptr) != SQLITE_OK)
+            return false;
+        sqlite3_bind_text(stmt, 1, listId.c_str(), -1, SQLITE_TRANSIENT);
+        bool found = false;
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            const char* data = static_cast<const char*>(sqlite3_column_blob(stmt, 0));
+            int size = sqlite3_column_bytes(stmt, 0);
+            msgpack::object_handle oh = msgpack::unpack(data, size);
+            ShoppingList list;
+            oh.get().convert(list);
+            found = true;
+        }
+        sqlite3_finalize(stmt);
+        return found;
+    }
+};
+
+int main(int argc, char* argv[]) {
+    size_t ops = argc > 1 ? stoul(argv[1]) : 20000;
+    vector<ShoppingList> lists = make_lists(ops);
+    size_t failed = 0;
+
+    remove_db();
+    double uncachedWrite, uncachedRead;
+    {
+        UncachedDb db;
+        if (!db.open()) {
+            cerr << "Failed to open " << DB_PATH << "\n";
+            return 1;
+        }
+        uncachedWrite = ops_per_sec(ops, [&] {
+            for (auto& list : lists) failed += !db.write(list);
+        });
+        uncachedRead = ops_per_sec(ops, [&] {
+            for (auto& list : lists) failed += !db.read(list.getUid());
+        });
+    }
+
+    remove_db();
+    double cachedWrite, cachedRead;
+    {
+        SqliteDb db;
+        if (!db.init_db(DB_PATH)) {
+            cerr << "Failed to open " << DB_PATH << "\n";
+            return 1;
+        }
+        cachedWrite = ops_per_sec(ops, [&] {
+            for (auto& list : lists) failed += !db.write(list);
+        });
+        cachedRead = ops_per_sec(ops, [&] {
+            for (auto& list : lists) failed += !db.read(list.getUid()).has_value();
+        });
+    }
+    remove_db();
+
+    if (failed) cerr << failed << " operations failed\n";
+    printf("%-7s %16s %16s %8s\n", "op", "prepare/call", "cached", "speedup");
+    printf("%-7s %12.0f/s %12.0f/s %7.2fx\n", "write", uncachedWrite, cachedWrite, cachedWrite / uncachedWrite);
+    printf("%-7s %12.0f/s %12.0f/s %7.2fx\n", "read", uncachedRead, cachedRead, cachedRead / uncachedRead);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,55 @@
+// Placement hash throughput on 32 character list uids: FNV-1a, which
+// placed lists before, against wyhash, plus a full HashRing lookup with
+// each. Build and run with `make bench`; optional arg: hashes per run.
+#include "util.hpp"
+#include "sharding/hash_ring.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static vector<string> make_uids(size_t n) {
+    static const char chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    mt19937 rng(42);
+    uniform_int_distribution<int> dist(0, 61);
+    vector<string> uids(n, string(32, 'x'));
+    for (auto& uid : uids)
+        for (auto& c : uid) c = chars[dist(rng)];
+    return uids;
+}
+
+// Hashes per second over rounds passes of the uids; the checksum keeps the
+// compiler from dropping the loop
+template <typename F>
+static double per_sec(const vector<string>& uids, size_t rounds, uint64_t& sink, F&& fn) {
+    auto start = chrono::steady_clock::now();
+    for (size_t r = 0; r < rounds; r++)
+        for (auto& uid : uids) sink += fn(uid);
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return uids.size() * rounds / secs;
+}
+
+int main(int argc, char* argv[]) {
+    size_t total = argc > 1 ? stoul(argv[1]) : 20000000;
+    vector<string> uids = make_uids(100000);
+    size_t rounds = max<size_t>(total / uids.size(), 1);
+    uint64_t sink = 0;
+
+    double fnv = per_sec(uids, rounds, sink, [](const string& s) { return Util::hash64(s); });
+    double wy = per_sec(uids, rounds, sink, [](const string& s) { return Util::wyhash64(s); });
+
+    HashRing fnvRing = HashRing::with_shards(8, {}, HashVersion::FNV1A);
+    HashRing wyRing = HashRing::with_shards(8, {}, HashVersion::WYHASH);
+    double fnvLookup = per_sec(uids, rounds, sink, [&](const string& s) { return fnvRing.shard_for(s); });
+    double wyLookup = per_sec(uids, rounds, sink, [&](const string& s) { return wyRing.shard_for(s); });
+
+    printf("%-12s %14s %14s %8s\n", "op", "fnv1a", "wyhash", "speedup");
+    printf("%-12s %12.0f/s %12.0f/s %7.2fx\n", "hash", fnv, wy, wy / fnv);
+    printf("%-12s %12.0f/s %12.0f/s %7.2fx\n", "ring lookup", fnvLookup, wyLookup, wyLookup / fnvLookup);
+    printf("(checksum %llu)\n", static_cast<unsigned long long>(sink % 1000));
+    return 0;
+}
@@ -0,0 +1,71 @@
+// Message serialization throughput for gossip frames of 1, 100 and 10000
+// lists: to_zmq and from_zmq, and fanning a frame out to three replicas by
+// packing per copy as push_shard_message did before, against packing once
+// and sending zmq_msg_copy of the frame. Build and run with `make bench`;
+// optional arg: lists packed per measurement.
+#include "message/message.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <zmq.hpp>
+
+using namespace message;
+using namespace std;
+
+static const size_t FANOUT = 3;
+
+static vector<ShoppingList> make_lists(size_t n) {
+    vector<ShoppingList> lists;
+    lists.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+        ShoppingList list("list-" + to_string(i), "bench");
+        for (int j = 0; j < 4; j++)
+            list.add("bench", ShoppingItem("bench", "item-" + to_string(i) + "-" + to_string(j), "milk", 2, 0));
+        lists.push_back(move(list));
+    }
+    return lists;
+}
+
+template <typename F>
+static double per_sec(size_t ops, F&& body) {
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < ops; i++) body();
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return ops / secs;
+}
+
+int main(int argc, char* argv[]) {
+    size_t budget = argc > 1 ? stoul(argv[1]) : 200000;
+    size_t sink = 0;
+
+    printf("%-7s %10s %12s %12s %14s %14s %8s\n",
+           "lists", "bytes", "to_zmq", "from_zmq", "fanout/pack", "fanout/copy", "speedup");
+    for (size_t n : {size_t(1), size_t(100), size_t(10000)}) {
+        Message m = Message::gossip_lists("bench", 0, make_lists(n));
+        size_t ops = max<size_t>(budget / n, 5);
+
+        zmq::message_t frame = m.to_zmq();
+        double pack = per_sec(ops, [&] { sink += m.to_zmq().size(); });
+        double unpack = per_sec(ops, [&] { sink += Message::from_zmq(frame).lists.size(); });
+
+        double perCopy = per_sec(ops, [&] {
+            for (size_t i = 0; i < FANOUT; i++) sink += m.to_zmq().size();
+        });
+        double once = per_sec(ops, [&] {
+            zmq::message_t packed = m.to_zmq();
+            for (size_t i = 1; i < FANOUT; i++) {
+                zmq::message_t copy;
+                copy.copy(packed);
+                sink += copy.size();
+            }
+            sink += packed.size();
+        });
+
+        printf("%-7zu %10zu %10.0f/s %10.0f/s %12.0f/s %12.0f/s %7.2fx\n",
+               n, frame.size(), pack, unpack, perCopy, once, once / perCopy);
+    }
+    printf("(checksum %zu)\n", sink % 1000);
+    return 0;
+}
@@ -1,50 +1,48 @@
 #include "api.hpp"
 #include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
 
 using namespace std;
 using namespace message;
 
 API::API(SqliteDb* db, string origin, int cloudTimeoutMs):
-    db(db), ctx(1), clientSocket(ctx, zmq::socket_type::req),
+    db(db), ctx(1),
+    submitPushSock(ctx, zmq::socket_type::push),
+    submitPullSock(ctx, zmq::socket_type::pull),
     origin(origin), cloudTimeoutMs(cloudTimeoutMs)
 {
-    clientSocket.set(zmq::sockopt::sndtimeo, cloudTimeoutMs);
-    clientSocket.set(zmq::sockopt::rcvtimeo, cloudTimeoutMs);
+    // One inproc endpoint per API instance, bound before connecting
+    string submitEndpoint = "inproc://api-calls-" + to_string(reinterpret_cast<uintptr_t>(this));
+    submitPullSock.bind(submitEndpoint);
+    submitPushSock.connect(submitEndpoint);
     shardEndpoints = unordered_map<int, vector<string>>{
         {0, vector<string>{"tcp://127.0.0.1:5000", "tcp://127.0.0.1:5001", "tcp://127.0.0.1:5002"}},
         {1, vector<string>{"tcp://127.0.0.1:5003", "tcp://127.0.0.1:5004", "tcp://127.0.0.1:5005"}}
     };
+    ring = HashRing::with_shards(shardEndpoints.size());
     randomEngine = mt19937{random_device{}()};
+    ioThread = thread(&API::ioLoop, this);
 }
 
 API::~API()
 {
-    int linger = 0;
-    clientSocket.set(zmq::sockopt::linger, 0);
-    clientSocket.close();
+    ioRunning = false;
+    if (ioThread.joinable()) ioThread.join();
+    submitPushSock.set(zmq::sockopt::linger, 0);
+    submitPushSock.close();
     ctx.close();
 }
 
-void API::setNodeEndpoint(const string &nodeEndpoint)
-{
-    if (currentEndpoint == nodeEndpoint) return;
-    if (!currentEndpoint.empty()) {
-        clientSocket.disconnect(currentEndpoint);
-    }
-    clientSocket.connect(nodeEndpoint);
-    currentEndpoint = nodeEndpoint;
-}
-
 string API::getShardEndpoint(const ShoppingList& lst) {
     return getShardEndpoint(lst.getUid());
 }
 
 string API::getShardEndpoint(const string& listUID) {
     shared_lock g(shardMutex);
-    int shard = Util::getHash(listUID) % shardEndpoints.size();
-    const vector<string>& endpoints = shardEndpoints[shard];
-    uniform_int_distribution<int> dist(0, endpoints.size() - 1);
-    return endpoints[dist(randomEngine)];
+    int shard = ring.shard_for(listUID);
+    return pickEndpoint(shardEndpoints[shard]);
 }
 
 string API::getShardEndpoint() {
@@ -53,8 +51,51 @@ string API::getShardEndpoint() {
     for (const auto& [shardId, endpoints]: shardEndpoints) {
         allEndpoints.insert(allEndpoints.end(), endpoints.begin(), endpoints.end());
     }
-    uniform_int_distribution<int> dist(0, allEndpoints.size() - 1);
-    return allEndpoints[dist(randomEngine)];
+    return pickEndpoint(allEndpoints);
+}
+
+// Expected cost of a call to the endpoint in microseconds: smoothed RTT plus
+// a timeout for the share of calls that fail. The estimate fades with its
+// age, so an endpoint avoided for a while is tried again and gets a fresh
+// sample instead of being shunned forever. Unknown endpoints cost nothing.
+double API::endpointScore(const string& endpoint, uint64_t nowUs) const {
+    auto it = endpointStats.find(endpoint);
+    if (it == endpointStats.end()) return 0;
+    const EndpointStats& st = it->second;
+    double cost = st.rttUs + st.errorRate * cloudTimeoutMs * 1000.0;
+    double ageHalfLives = double(nowUs - st.updatedUs) / STATS_HALF_LIFE_US;
+    return cost * exp2(-ageHalfLives);
+}
+
+// Power of two choices: of two distinct random endpoints, the one with the
+// lower score. Cheaper than ranking all of them and keeps load spread, since
+// the best replica is not chosen by every client at once.
+string API::pickEndpoint(const vector<string>& endpoints) {
+    if (endpoints.size() == 1) return endpoints[0];
+
+    lock_guard<mutex> g(statsMutex);
+    uniform_int_distribution<size_t> dist(0, endpoints.size() - 1);
+    size_t a = dist(randomEngine);
+    size_t b = dist(randomEngine);
+    if (a == b) b = (b + 1) % endpoints.size();
+
+    uint64_t now = Util::now_us();
+    return endpointScore(endpoints[a], now) <= endpointScore(endpoints[b], now) ?
+        endpoints[a] : endpoints[b];
+}
+
+void API::recordOutcome(const string& endpoint, uint64_t rttUs, bool ok) {
+    lock_guard<mutex> g(statsMutex);
+    auto [it, inserted] = endpointStats.try_emplace(endpoint);
+    EndpointStats& st = it->second;
+    if (inserted) {
+        st.rttUs = rttUs;
+        st.errorRate = ok ? 0 : 1;
+    } else {
+        st.rttUs += STATS_ALPHA * (double(rttUs) - st.rttUs);
+        st.errorRate += STATS_ALPHA * ((ok ? 0.0 : 1.0) - st.errorRate);
+    }
+    st.updatedUs = Util::now_us();
 }
 
 string API::createUID(size_t length) {
@@ -63,48 +104,306 @@ string API::createUID(size_t length) {
     string id(length, 'x');
     do
     {
+        // Not held across the db lookup, only while drawing
+        lock_guard<mutex> g(statsMutex);
         for (auto &c : id)
             c = chars[dist(randomEngine)];
     } while (db->read(id).has_value());
     return id;
 }
 
-void API::resetSocket() {
-    clientSocket.set(zmq::sockopt::linger, 0);
-    clientSocket.close();
-    clientSocket = zmq::socket_t(ctx, zmq::socket_type::req);
-    clientSocket.set(zmq::sockopt::sndtimeo, cloudTimeoutMs);
-    clientSocket.set(zmq::sockopt::rcvtimeo, cloudTimeoutMs);
-    if (!currentEndpoint.empty()) clientSocket.connect(currentEndpoint);
-}
+// Owns the submit PULL socket and one DEALER per node. Requests from any
+// thread arrive as [endpoint][call id][payload] and go out on that node's
+// DEALER as [call id][payload]; the node echoes the envelope, so the id on
+// the reply picks the caller to wake. Any number of calls can be in flight,
+// to the same node or to different shards.
+void API::ioLoop() {
+    unordered_map<string, zmq::socket_t> dealers;
+    vector<zmq::socket_t*> polled;
+    vector<zmq::pollitem_t> items;
+
+    while (ioRunning) {
+        polled.clear();
+        items.clear();
+        items.push_back({ static_cast<void*>(submitPullSock), 0, ZMQ_POLLIN, 0 });
+        for (auto& [_, sock] : dealers) {
+            polled.push_back(&sock);
+            items.push_back({ static_cast<void*>(sock), 0, ZMQ_POLLIN, 0 });
+        }
 
-Message API::sendCloudMessage(string receiverAddress, const Message& m) {
-    lock_guard<mutex> g(socketMutex);
-    setNodeEndpoint(receiverAddress);
+        try {
+            zmq::poll(items, chrono::milliseconds(100));
 
-    try {
-        clientSocket.send(m.to_zmq(), zmq::send_flags::none);
+            if (items[0].revents & ZMQ_POLLIN)
+                forwardCalls(dealers);
+            for (size_t i = 0; i < polled.size(); i++) {
+                if (items[i + 1].revents & ZMQ_POLLIN)
+                    completeCalls(*polled[i]);
+            }
+        } catch (const zmq::error_t& e) {
+            cerr << "ZMQ error: " << e.what() << endl;
+        }
+    }
 
-        zmq::message_t reply;
-        zmq::recv_result_t result = clientSocket.recv(reply);
+    for (auto& [_, sock] : dealers) {
+        sock.set(zmq::sockopt::linger, 0);
+        sock.close();
+    }
+    submitPullSock.set(zmq::sockopt::linger, 0);
+    submitPullSock.close();
+}
 
-        if (!result) { // socket timeout
-            resetSocket();
-            string errMsg = "CLOUD TIMEOUT when sending <" + to_string(static_cast<int>(m.op)) + "> (op type) to " + receiverAddress;
-            throw runtime_error(errMsg);
+void API::forwardCalls(unordered_map<string, zmq::socket_t>& dealers) {
+    zmq::message_t endpoint, callId, payload;
+    while (submitPullSock.recv(endpoint, zmq::recv_flags::dontwait)) {
+        submitPullSock.recv(callId, zmq::recv_flags::none);
+        submitPullSock.recv(payload, zmq::recv_flags::none);
+
+        string address = endpoint.to_string();
+        auto it = dealers.find(address);
+        if (it == dealers.end()) {
+            zmq::socket_t sock(ctx, zmq::socket_type::dealer);
+            sock.set(zmq::sockopt::linger, 0);
+            sock.connect(address);
+            it = dealers.emplace(address, move(sock)).first;
         }
-        return Message::from_zmq(reply);
+
+        // A full send queue means the node is not keeping up; fail fast
+        // rather than stall every other call behind it
+        bool sent = it->second.send(callId, zmq::send_flags::sndmore | zmq::send_flags::dontwait) &&
+            it->second.send(payload, zmq::send_flags::dontwait);
+        if (!sent) {
+            uint64_t id;
+            memcpy(&id, callId.data(), sizeof(id));
+            failCall(id, "CLOUD BUSY: send queue to " + address + " is full");
+        }
+    }
+}
+
+void API::completeCalls(zmq::socket_t& dealer) {
+    zmq::message_t callId, payload;
+    while (dealer.recv(callId, zmq::recv_flags::dontwait)) {
+        if (!callId.more()) continue; // not one of ours
+        dealer.recv(payload, zmq::recv_flags::none);
+        while (payload.more()) dealer.recv(payload, zmq::recv_flags::none);
+        if (callId.size() != sizeof(uint64_t)) continue;
+
+        uint64_t id;
+        memcpy(&id, callId.data(), sizeof(id));
+        shared_ptr<CallSlot> slot = takeCall(id);
+        if (!slot) continue; // caller already gave up on it
+
+        {
+            lock_guard<mutex> g(slot->mtx);
+            if (!slot->reply.has_value()) { // first attempt to answer wins
+                slot->reply = move(payload);
+                slot->winner = id;
+                slot->repliedUs = Util::now_us();
+            }
+        }
+        slot->cv.notify_all();
+        payload = zmq::message_t();
+    }
+}
+
+void API::failCall(uint64_t id, const string& error) {
+    shared_ptr<CallSlot> slot = takeCall(id);
+    if (!slot) return;
+    cerr << error << endl;
+    {
+        lock_guard<mutex> g(slot->mtx);
+        slot->failed.push_back(id);
+    }
+    slot->cv.notify_all();
+}
+
+shared_ptr<API::CallSlot> API::takeCall(uint64_t id) {
+    lock_guard<mutex> g(callsMutex);
+    auto it = pendingCalls.find(id);
+    if (it == pendingCalls.end()) return nullptr;
+    shared_ptr<CallSlot> slot = move(it->second);
+    pendingCalls.erase(it);
+    return slot;
+}
+
+// Registers an attempt answering into slot and hands it to the I/O thread.
+// The payload is reference counted, so attempts at several replicas share
+// one encoding.
+uint64_t API::submitCall(const string& endpoint, zmq::message_t& payload, const shared_ptr<CallSlot>& slot) {
+    uint64_t id = nextCallId++;
+    {
+        lock_guard<mutex> g(callsMutex);
+        pendingCalls[id] = slot;
+    }
+
+    zmq::message_t body;
+    body.copy(payload);
+    try {
+        lock_guard<mutex> g(submitMutex);
+        submitPushSock.send(zmq::message_t(endpoint.data(), endpoint.size()), zmq::send_flags::sndmore);
+        submitPushSock.send(zmq::message_t(&id, sizeof(id)), zmq::send_flags::sndmore);
+        submitPushSock.send(body, zmq::send_flags::none);
     } catch (const zmq::error_t& e) {
         cerr << "ZMQ error: " << e.what() <<  endl;
-        resetSocket();
+        takeCall(id);
         throw runtime_error(e.what());
     }
-    catch (const std::exception& e) {
+    return id;
+}
+
+void API::cancelCalls(const vector<uint64_t>& ids) {
+    lock_guard<mutex> g(callsMutex);
+    for (uint64_t id : ids)
+        pendingCalls.erase(id);
+}
+
+// Hands the request to the I/O thread and waits for its reply only; other
+// callers are not blocked while this one is in flight
+Message API::sendCloudMessage(string receiverAddress, const Message& m) {
+    auto slot = make_shared<CallSlot>();
+    uint64_t start = Util::now_us();
+    try {
+        zmq::message_t payload = m.to_zmq();
+        uint64_t id = submitCall(receiverAddress, payload, slot);
+
+        unique_lock<mutex> lk(slot->mtx);
+        bool done = slot->cv.wait_for(lk, chrono::milliseconds(cloudTimeoutMs),
+            [&] { return slot->reply.has_value() || !slot->failed.empty(); });
+        bool ok = slot->reply.has_value();
+        lk.unlock();
+        recordOutcome(receiverAddress, Util::now_us() - start, ok);
+        if (!ok) {
+            cancelCalls({id});
+            string errMsg = (done ? "CLOUD SEND FAILED" : "CLOUD TIMEOUT") + string(" when sending <") +
+                to_string(static_cast<int>(m.op)) + "> (op type) to " + receiverAddress;
+            throw runtime_error(errMsg);
+        }
+        return Message::from_zmq(*slot->reply);
+    } catch (const std::exception& e) {
         cerr << "General error: " << e.what() << endl;
         throw runtime_error(e.what());
     }
 }
 
+// Waits about as long as 95% of recent reads took before asking another
+// replica, so roughly one read in twenty is duplicated and the delay follows
+// the cluster when it speeds up or slows down. Until enough reads have been
+// seen, a third of the timeout is used.
+chrono::microseconds API::hedgeDelay() const {
+    if (recentReads.count() < HEDGE_MIN_SAMPLES)
+        return chrono::milliseconds(cloudTimeoutMs) / 3;
+    uint64_t p95 = recentReads.percentile(0.95);
+    return chrono::microseconds(max<uint64_t>(p95, HEDGE_MIN_DELAY_US));
+}
+
+// Reads from the list's replicas in random order: the first one gets the
+// request, and the next replica is asked too whenever a hedge delay passes
+// without an answer, or right away once every outstanding attempt has
+// failed. The first reply wins; all attempts share one deadline of
+// cloudTimeoutMs.
+Message API::sendHedgedRead(const string& listUID, const Message& m) {
+    vector<string> replicas;
+    {
+        shared_lock g(shardMutex);
+        replicas = shardEndpoints[ring.shard_for(listUID)];
+    }
+    if (replicas.empty())
+        throw runtime_error("No replicas known for list " + listUID);
+    {
+        // Best of two first, the rest as fallbacks in random order
+        string first = pickEndpoint(replicas);
+        lock_guard<mutex> g(statsMutex);
+        shuffle(replicas.begin(), replicas.end(), randomEngine);
+        swap(*find(replicas.begin(), replicas.end(), first), replicas[0]);
+    }
+
+    auto start = chrono::steady_clock::now();
+    auto deadline = start + chrono::milliseconds(cloudTimeoutMs);
+    auto hedgeAt = start + hedgeDelay();
+
+    zmq::message_t payload = m.to_zmq();
+    auto slot = make_shared<CallSlot>();
+    vector<uint64_t> attempts, submittedUs;
+    size_t next = 0;
+    submittedUs.push_back(Util::now_us());
+    attempts.push_back(submitCall(replicas[next++], payload, slot));
+
+    unique_lock<mutex> lk(slot->mtx);
+    while (!slot->reply.has_value()) {
+        auto wake = next < replicas.size() ? min(hedgeAt, deadline) : deadline;
+        slot->cv.wait_until(lk, wake,
+            [&] { return slot->reply.has_value() || slot->failed.size() == attempts.size(); });
+        if (slot->reply.has_value()) break;
+
+        auto now = chrono::steady_clock::now();
+        bool allFailed = slot->failed.size() == attempts.size();
+        if (now >= deadline || (allFailed && next == replicas.size()))
+            break;
+
+        // A replica that has not answered by the hedge delay is treated like
+        // a failed one: the next replica is asked and gets a delay of its own
+        if (next == replicas.size()) continue;
+        if (allFailed) {
+            readRetries++;
+        } else if (now >= hedgeAt) {
+            readHedges++;
+        } else {
+            continue;
+        }
+        lk.unlock();
+        submittedUs.push_back(Util::now_us());
+        attempts.push_back(submitCall(replicas[next++], payload, slot));
+        hedgeAt = chrono::steady_clock::now() + hedgeDelay();
+        lk.lock();
+    }
+
+    optional<zmq::message_t> reply = move(slot->reply);
+    uint64_t winner = slot->winner;
+    uint64_t endUs = reply.has_value() ? slot->repliedUs : Util::now_us();
+    vector<uint64_t> failed = move(slot->failed);
+    lk.unlock();
+    cancelCalls(attempts);
+
+    // Each attempt is measured from its own submit. The winner gives a real
+    // RTT. A loser still outstanding is censored: it is only known to take
+    // longer than it had, so it counts as an error if it had at least as
+    // long as the winner needed, and says nothing otherwise. A hedge sent
+    // while the winning reply was already arriving had no time at all.
+    auto rtt = [&](size_t i) { return endUs > submittedUs[i] ? endUs - submittedUs[i] : 0; };
+    uint64_t winnerRttUs = 0;
+    for (size_t i = 0; i < attempts.size(); i++) {
+        if (attempts[i] == winner) winnerRttUs = rtt(i);
+    }
+    for (size_t i = 0; i < attempts.size(); i++) {
+        uint64_t rttUs = rtt(i);
+        bool attemptFailed = find(failed.begin(), failed.end(), attempts[i]) != failed.end();
+        if (attempts[i] == winner && reply.has_value())
+            recordOutcome(replicas[i], rttUs, true);
+        else if (attemptFailed || !reply.has_value() || rttUs >= winnerRttUs)
+            recordOutcome(replicas[i], rttUs, false);
+    }
+    uint64_t elapsedUs = rtt(0);
+
+    if (!reply.has_value()) {
+        readFailures++;
+        throw runtime_error("CLOUD TIMEOUT when reading list " + listUID + " from " +
+            to_string(attempts.size()) + " replica(s)");
+    }
+    if (winner != attempts[0]) readHedgeWins++;
+    readLatency.record(elapsedUs);
+    recentReads.record(elapsedUs);
+    return Message::from_zmq(*reply);
+}
+
+string API::readLatencyReport() const {
+    return readLatency.summary() +
+        " recent_p95=" + to_string(recentReads.percentile(0.95)) + "us" +
+        " hedges=" + to_string(readHedges.load()) +
+        " hedge_wins=" + to_string(readHedgeWins.load()) +
+        " retries=" + to_string(readRetries.load()) +
+        " failures=" + to_string(readFailures.load());
+}
+
 ShoppingList API::createShoppingList(const string &name) {
     string uid = createUID();
     ShoppingList lst(uid, name);
@@ -116,6 +415,8 @@ ShoppingList API::createShoppingList(const string &name) {
     Message m = Message::ensure_list(origin, Util::now_ms(), lst);
     try {
         Message reply = sendCloudMessage(getShardEndpoint(lst), m);
+        if (reply.op == OpType::LIST_RESPONSE)
+            markSynced(lst);
     } catch (const exception& e) {}
 
     return lst;
@@ -127,9 +428,10 @@ ShoppingList API::getShoppingList(const string& listUID) {
     Message m = Message::get_list(origin, Util::now_ms(), listUID);
     optional<ShoppingList> maybeCloudList;
     try {
-        Message reply = sendCloudMessage(getShardEndpoint(listUID), m);
+        Message reply = sendHedgedRead(listUID, m);
         if (reply.op == OpType::LIST_RESPONSE) {
             maybeCloudList = reply.lists[0];
+            markSynced(*maybeCloudList);
         }
     } catch (const exception& e) {}
 
@@ -159,13 +461,14 @@ ShoppingList API::addItem(const string &listUID, string itemName, int desiredQua
 
     ShoppingList lst = move(optList.value());
     ShoppingItem item(origin, createUID(), itemName, desiredQuantity, currentQuantity);
-    lst.add(item);
+    lst.add(origin, item);
 
     Message m = Message::ensure_list(origin, Util::now_ms(), lst);
     try {
         Message reply = sendCloudMessage(getShardEndpoint(lst), m);
         if (reply.op == OpType::LIST_RESPONSE) {
             lst.merge(reply.lists[0]);
+            markSynced(lst);
         }
     } catch (const exception& e) {}
 
@@ -187,13 +490,14 @@ ShoppingList API::updateItem(const string &listUID, const string &itemUID, strin
     item.setName(itemName);
     item.setDesiredQuantity(origin, desiredQuantity);
     item.setCurrentQuantity(origin, currentQuantity);
-    lst.update(item);
+    lst.update(origin, item);
 
     Message m = Message::ensure_list(origin, Util::now_ms(), lst);
     try {
         Message reply = sendCloudMessage(getShardEndpoint(lst), m);
         if (reply.op == OpType::LIST_RESPONSE) {
             lst.merge(reply.lists[0]);
+            markSynced(lst);
         }
     } catch (const exception& e) {}
 
@@ -219,6 +523,7 @@ ShoppingList API::removeItem(const string &listUID, const string &itemUID) {
         Message reply = sendCloudMessage(getShardEndpoint(lst), m);
         if (reply.op == OpType::LIST_RESPONSE) {
             lst.merge(reply.lists[0]);
+            markSynced(lst);
         }
     } catch (const exception& e) {}
 
@@ -234,6 +539,11 @@ void API::deleteShoppingList(const string &listUID) {
         lock_guard<mutex> g(dbMutex);
         db->delete_list(listUID);
     }
+    {
+        lock_guard<mutex> g(syncMutex);
+        cloudDigests.erase(listUID);
+        unsynced.erase(listUID);
+    }
 
     Message m = Message::delete_list(origin, Util::now_ms(), listUID);
     try {
@@ -244,27 +554,83 @@ void API::deleteShoppingList(const string &listUID) {
     } catch (const exception& e) {}
 }
 
+// The cloud holds at least this state of the list; merging is monotonic,
+// so a local copy with the same digest has nothing new to send
+void API::markSynced(const ShoppingList& lst) {
+    lock_guard<mutex> g(syncMutex);
+    cloudDigests[lst.getUid()] = lst.digest();
+}
+
+bool API::isSynced(const ShoppingList& lst) {
+    lock_guard<mutex> g(syncMutex);
+    auto it = cloudDigests.find(lst.getUid());
+    return it != cloudDigests.end() && it->second == lst.digest();
+}
+
+// Sends only lists that changed locally since the cloud last acknowledged
+// them: new entries of the local change feed plus lists whose earlier send
+// failed. Lists the cloud already holds (written back after a request or a
+// fetch) are skipped, so an idle client sends nothing. The db lock is only
+// held while a page is read.
 void API::gossipState() {
+    const size_t pageSize = 256;
 
-    vector<ShoppingList> allLists;
+    vector<string> retryIds;
     {
-        lock_guard<mutex> g(dbMutex);
-        allLists = db->read_all();
+        lock_guard<mutex> g(syncMutex);
+        retryIds.assign(unsynced.begin(), unsynced.end());
     }
-    if (allLists.empty()) return;
 
-    unordered_map <int, vector<ShoppingList>> shardLists;
-    for (const auto& lst : allLists) {
-        int shard = Util::getHash(lst.getUid()) % shardEndpoints.size();
-        shardLists[shard].push_back(lst);
-    }
+    bool firstPage = true;
+    while (true) {
+        vector<ShoppingList> lists;
+        size_t changed;
+        {
+            lock_guard<mutex> g(dbMutex);
+            vector<ChangedList> page = db->read_changed_since(gossipCursor, pageSize);
+            changed = page.size();
+            if (!page.empty()) gossipCursor = page.back().seq;
+            for (auto& change : page)
+                lists.push_back(move(change.list));
+
+            if (firstPage && !retryIds.empty()) {
+                for (auto& opt : db->read_many(retryIds)) {
+                    if (opt.has_value()) lists.push_back(move(*opt));
+                }
+            }
+        }
+        firstPage = false;
+
+        unordered_map <int, vector<ShoppingList>> shardLists;
+        {
+            shared_lock g(shardMutex);
+            for (auto& lst : lists) {
+                if (!isSynced(lst))
+                    shardLists[ring.shard_for(lst.getUid())].push_back(move(lst));
+            }
+        }
 
-    for (const auto& [shard, lists]: shardLists) {
-        string shardEndpoint = getShardEndpoint(lists[0]);
-        Message m = Message::gossip_lists(origin, Util::now_ms(), lists);
-        try {
-            Message reply = sendCloudMessage(shardEndpoint, m);
-        } catch (const exception& e) {}
+        for (const auto& [shard, pending]: shardLists) {
+            string shardEndpoint = getShardEndpoint(pending[0]);
+            Message m = Message::gossip_lists(origin, Util::now_ms(), pending);
+            bool sent = false;
+            try {
+                Message reply = sendCloudMessage(shardEndpoint, m);
+                sent = reply.op == OpType::LIST_RESPONSE;
+            } catch (const exception& e) {}
+
+            lock_guard<mutex> g(syncMutex);
+            for (const auto& lst : pending) {
+                if (sent) {
+                    cloudDigests[lst.getUid()] = lst.digest();
+                    unsynced.erase(lst.getUid());
+                } else {
+                    unsynced.insert(lst.getUid());
+                }
+            }
+        }
+
+        if (changed < pageSize) return;
     }
 }
 
@@ -272,16 +638,23 @@ void API::updateCloudNodes() {
     Message m = Message::get_nodes(origin, Util::now_ms());
     string endpoint = getShardEndpoint();
     lock_guard<shared_mutex> g(shardMutex);
-    for (auto [shardId, endpoints]: shardEndpoints) {
-        endpoints.clear();
-    }
 
     try {
         Message reply = sendCloudMessage(endpoint, m);
         if (reply.op == OpType::NODES_RESPONSE) {
+            unordered_map<int, vector<string>> endpoints;
+            HashRing nodesRing(reply.nodes.empty() ? HashVersion::WYHASH :
+                static_cast<HashVersion>(reply.nodes.front().placementHash));
             for (const auto& nodeInfo : reply.nodes) {
+                // A shard still being filled by a reshard is not routable yet
+                if (nodeInfo.shardWeight == 0) continue;
                 string addr = "tcp://" + nodeInfo.host + ":" + to_string(nodeInfo.clientPort);
-                shardEndpoints[nodeInfo.shardId].push_back(addr);
+                endpoints[nodeInfo.shardId].push_back(addr);
+                nodesRing.set_shard(nodeInfo.shardId, nodeInfo.shardWeight);
+            }
+            if (!endpoints.empty()) {
+                shardEndpoints = move(endpoints);
+                ring = move(nodesRing);
             }
         } else {
             throw runtime_error("Unexpected response op when getting cloud nodes");
@@ -6,16 +6,23 @@
 #include <mutex>
 #include <shared_mutex>
 #include <unordered_map>
+#include <unordered_set>
 #include <random>
 #include <ctime>
 #include <stdexcept>
-#include <zmq.hpp>
-#include <random>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <optional>
+#include <thread>
 
 #include "../model/shopping_list.hpp"
 #include "../persistence/sqlite_db.hpp"
 #include "../message/message.hpp"
-#include "util.cpp"
+#include "../sharding/hash_ring.hpp"
+#include "../metrics/latency_histogram.hpp"
+#include "../metrics/latency_window.hpp"
+#include "util.hpp"
 
 
 class API
@@ -31,25 +38,81 @@ public:
     void deleteShoppingList(const std::string &listUID);
     void gossipState();
     void updateCloudNodes();
+    std::string readLatencyReport() const; // cloud read latency, hedges and retries
 
 private:
     SqliteDb *db;
     std::string origin;
     int cloudTimeoutMs;
     zmq::context_t ctx;
-    zmq::socket_t clientSocket;
-    std::string currentEndpoint;
-    std::mutex socketMutex, dbMutex; // dbMutex is used to protect db access between gossip read and request writes
+    std::mutex dbMutex; // dbMutex is used to protect db access between gossip read and request writes
+
+    // Cloud calls: callers submit over inproc and wait on their slot; the
+    // I/O thread owns every node socket. Several attempts of one request
+    // (hedges, retries) share a slot and the first reply fills it.
+    struct CallSlot {
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::optional<zmq::message_t> reply;
+        uint64_t winner = 0; // call id of the attempt that answered
+        uint64_t repliedUs = 0; // when the winning reply reached the I/O thread
+        std::vector<uint64_t> failed; // call ids of attempts that could not be sent
+    };
+    zmq::socket_t submitPushSock, submitPullSock;
+    std::mutex submitMutex, callsMutex;
+    unordered_map<uint64_t, std::shared_ptr<CallSlot>> pendingCalls;
+    std::atomic<uint64_t> nextCallId{1};
+    std::atomic<bool> ioRunning{true};
+    std::thread ioThread;
     std::shared_mutex shardMutex;
     std::string createUID(size_t length = 32);
     unordered_map<int, std::vector<std::string>> shardEndpoints;
+    HashRing ring; // same placement as the nodes, rebuilt from their advertised weights
     std::mt19937 randomEngine;
+    uint64_t gossipCursor = 0; // local change feed position already considered for sync
+
+    // Sync state per list: the digest the cloud acknowledged and the lists
+    // whose last send failed
+    std::mutex syncMutex;
+    unordered_map<std::string, uint64_t> cloudDigests;
+    std::unordered_set<std::string> unsynced;
+    void markSynced(const ShoppingList& lst);
+    bool isSynced(const ShoppingList& lst);
+
+    // Per-endpoint call outcomes, smoothed, used to steer away from slow
+    // or failing replicas
+    struct EndpointStats {
+        double rttUs = 0;
+        double errorRate = 0;
+        uint64_t updatedUs = 0;
+    };
+    static constexpr double STATS_ALPHA = 0.2;
+    static constexpr double STATS_HALF_LIFE_US = 10e6;
+    std::mutex statsMutex; // also guards randomEngine, shared by endpoint picks and createUID
+    unordered_map<std::string, EndpointStats> endpointStats;
+    double endpointScore(const std::string& endpoint, uint64_t nowUs) const;
+    std::string pickEndpoint(const std::vector<std::string>& endpoints);
+    void recordOutcome(const std::string& endpoint, uint64_t rttUs, bool ok);
 
     string getShardEndpoint();
     string getShardEndpoint(const string& listUID);
     string getShardEndpoint(const ShoppingList& list);
-    void setNodeEndpoint(const std::string &nodeEndpoint);
-    void resetSocket();
+    void ioLoop();
+    void forwardCalls(unordered_map<std::string, zmq::socket_t>& dealers);
+    void completeCalls(zmq::socket_t& dealer);
+    void failCall(uint64_t id, const std::string& error);
+    std::shared_ptr<CallSlot> takeCall(uint64_t id);
+    uint64_t submitCall(const std::string& endpoint, zmq::message_t& payload, const std::shared_ptr<CallSlot>& slot);
+    void cancelCalls(const std::vector<uint64_t>& ids);
+
+    // Hedged reads across a shard's replicas
+    static constexpr uint64_t HEDGE_MIN_SAMPLES = 20;
+    static constexpr uint64_t HEDGE_MIN_DELAY_US = 1000;
+    LatencyHistogram readLatency;     // successful cloud reads, first reply, since start
+    LatencyWindow<256> recentReads;   // the same for the last reads only; drives the hedge delay
+    std::atomic<uint64_t> readHedges{0}, readHedgeWins{0}, readRetries{0}, readFailures{0};
+    std::chrono::microseconds hedgeDelay() const;
+    message::Message sendHedgedRead(const std::string& listUID, const message::Message& m);
     message::Message sendCloudMessage(std::string receiverAddress, const message::Message& m);
 };
 
@@ -28,9 +28,17 @@ int main(int argc, char* argv[]) {
     auto opts = Http::Endpoint::options().threads(1);
 
     SqliteDb db;
-    db.init_db("db/shopping" + std::to_string(port) + ".db");
+    std::string dbPath = "db/shopping" + std::to_string(port) + ".db";
+    if (!db.init_db(dbPath)) {
+        std::cerr << "Failed to open " << dbPath << std::endl;
+        return 1;
+    }
 
-    API api(&db, host + ":" + std::to_string(port), 150);
+    // CRDT replica ids derive from the origin, so it must differ between clients
+    // even when they listen on the same host and port, and stay the same for
+    // one database so restarts do not add replicas to every list's metadata
+    std::string origin = host + ":" + std::to_string(port) + "#" + db.replica_id();
+    API api(&db, origin, 150);
 
     Router router;
 
@@ -67,6 +75,7 @@ int main(int argc, char* argv[]) {
         nodeUpdateThread.join();
     }
     server.shutdown();
+    std::cout << "Cloud reads: " << api.readLatencyReport() << std::endl;
     std::cout << "Server stopped." << std::endl;
     return 0;
 }
\ No newline at end of file
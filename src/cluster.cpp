@@ -1,6 +1,6 @@
 #include "node/node.hpp"
 #include "message/message.hpp"
-#include "util.cpp"
+#include "util.hpp"
 
 #include <thread>
 #include <chrono>
@@ -8,6 +8,7 @@
 #include <sstream>
 #include <vector>
 #include <memory>
+#include <unordered_set>
 #include <zmq.hpp>
 
 using namespace std;
@@ -43,11 +44,15 @@ NodeConfig make_config(
     c.discoveryIntervalMs = 1000;
     c.discoveryTimeoutMs = 10000;
     c.dbPath = "db/" + to_string(idx) + "test.db";
+    c.durability.groupCommitMs = 20;
     return c;
 }
 
 int main() {
-    const int numShards = 2;
+    int numShards = 2;
+    int migratingShard = -1; // shard being filled by a reshard, -1 if none
+    uint32_t migratingWeight = 1;
+    unordered_set<string> cutOver; // nodes already on the grown ring while a cutover is retried
     const int baseClientPort = 5000;
     const int baseGossipPullPort = 7000;
     const int baseDiscoveryPullPort = 8000;
@@ -111,6 +116,9 @@ int main() {
     cout << "  remove <nodeId>\n";
     cout << "  list\n";
     cout << "  peers <nodeId>\n";
+    cout << "  reshard <replicas> [weight]\n";
+    cout << "  migration\n";
+    cout << "  cutover\n";
     cout << "  quit\n";
 
     zmq::context_t cliCtx(1);
@@ -245,9 +253,158 @@ int main() {
             for (auto& rn : nodes) {
                 cout << rn.cfg.nodeId
                      << " shard=" << rn.cfg.shardId
-                     << " alive=" << (rn.alive ? "yes" : "no")
-                     << "\n";
+                     << " alive=" << (rn.alive ? "yes" : "no");
+                if (rn.alive)
+                    cout << " cacheHits=" << rn.node->cache_hits()
+                         << " cacheMisses=" << rn.node->cache_misses()
+                         << " latency " << rn.node->latency_report();
+                cout << "\n";
+            }
+        }
+
+        // ---------------- reshard ----------------
+        // Starts the replicas of a new shard, then lets every existing node
+        // stream the lists the new shard will own while it keeps serving them
+        else if (cmd == "reshard") {
+            int replicas;
+            uint32_t weight = 1;
+            ss >> replicas;
+            if (ss.fail() || replicas <= 0) {
+                cout << "[ERROR] Usage: reshard <replicas> [weight]\n";
+                continue;
+            }
+            ss >> weight;
+            if (ss.fail() || weight == 0) weight = 1;
+
+            if (migratingShard >= 0) {
+                cout << "[ERROR] Shard " << migratingShard << " is still migrating\n";
+                continue;
+            }
+
+            vector<NodeInfo> bootstrap;
+            for (auto& rn : nodes) {
+                if (!rn.alive) continue;
+                bootstrap.push_back({
+                    rn.cfg.nodeId,
+                    rn.cfg.host,
+                    rn.cfg.shardId,
+                    rn.cfg.clientPort,
+                    rn.cfg.gossipPullPort,
+                    rn.cfg.discoveryPullPort,
+                    0
+                });
+                break;
+            }
+            if (bootstrap.empty()) {
+                cout << "[ERROR] No alive node to bootstrap from\n";
+                continue;
+            }
+
+            int newShard = numShards;
+            for (int r = 0; r < replicas; r++) {
+                NodeConfig cfg = make_config(
+                    nextNodeIdx++,
+                    newShard,
+                    numShards + 1,
+                    baseClientPort,
+                    baseGossipPullPort,
+                    baseDiscoveryPullPort
+                );
+                cfg.shardWeights = nodes.front().cfg.shardWeights;
+                cfg.placementHash = nodes.front().cfg.placementHash;
+                cfg.shardWeights[newShard] = weight;
+                cfg.initialPeers = bootstrap;
+                cfg.joining = true;
+
+                auto node = make_unique<Node>(cfg);
+                node->start();
+                nodes.push_back({ std::move(node), cfg, true });
+                cout << "[CLUSTER] Added node " << cfg.nodeId
+                     << " to new shard " << newShard << "\n";
+            }
+
+            // Existing nodes need to learn the new replicas before streaming
+            sleep_ms(3 * nodes.front().cfg.discoveryIntervalMs);
+
+            migratingShard = newShard;
+            migratingWeight = weight;
+            cutOver.clear();
+            for (auto& rn : nodes) {
+                if (!rn.alive || rn.cfg.shardId == newShard) continue;
+                if (!rn.node->begin_migration(newShard, weight))
+                    cout << "[ERROR] " << rn.cfg.nodeId << " could not start migrating\n";
+            }
+            cout << "[CLUSTER] Migrating to shard " << newShard << "\n";
+        }
+
+        // ---------------- migration ----------------
+        else if (cmd == "migration") {
+            for (auto& rn : nodes) {
+                if (!rn.alive) continue;
+                MigrationStatus st = rn.node->migration_status();
+                if (!st.active) continue;
+                cout << rn.cfg.nodeId
+                     << " -> shard " << st.targetShard
+                     << " scanned=" << int(st.scanned * 100) << "%"
+                     << " lists=" << st.listsSent
+                     << " bytes=" << st.bytesSent
+                     << " pending=" << st.pendingLists
+                     << " unacked=" << st.unackedLists
+                     << " lists/s=" << st.listsPerSec
+                     << (st.complete ? " complete" : "") << "\n";
+            }
+        }
+
+        // ---------------- cutover ----------------
+        else if (cmd == "cutover") {
+            if (migratingShard < 0) {
+                cout << "[ERROR] No migration in progress\n";
+                continue;
+            }
+
+            bool ready = true;
+            for (auto& rn : nodes) {
+                if (rn.alive && rn.cfg.shardId != migratingShard && !cutOver.count(rn.cfg.nodeId) &&
+                    !rn.node->migration_status().complete) {
+                    cout << "[ERROR] " << rn.cfg.nodeId << " has not finished streaming\n";
+                    ready = false;
+                }
+            }
+            if (!ready) continue;
+
+            // Nodes that fail keep their migration, so cutover can be rerun
+            // once they have streamed and confirmed what they still owe
+            bool failed = false;
+            for (auto& rn : nodes) {
+                if (!rn.alive || rn.cfg.shardId == migratingShard || cutOver.count(rn.cfg.nodeId)) continue;
+                if (rn.node->finish_migration()) {
+                    cutOver.insert(rn.cfg.nodeId);
+                } else {
+                    cout << "[ERROR] " << rn.cfg.nodeId << " failed to cut over\n";
+                    failed = true;
+                }
+            }
+            if (failed) {
+                cout << "[ERROR] Cutover incomplete, run cutover again\n";
+                continue;
+            }
+
+            for (auto& rn : nodes) {
+                if (rn.cfg.shardId == migratingShard) {
+                    // The new shard becomes visible to clients only now
+                    if (rn.alive) rn.node->complete_join();
+                    rn.cfg.joining = false;
+                } else {
+                    // Restarted nodes come back with the grown ring
+                    rn.cfg.numShards = numShards + 1;
+                    rn.cfg.shardWeights[migratingShard] = migratingWeight;
+                }
             }
+            cutOver.clear();
+            numShards++;
+            cout << "[CLUSTER] Shard " << migratingShard << " is live, "
+                 << numShards << " shards\n";
+            migratingShard = -1;
         }
 
         // ---------------- peers ----------------
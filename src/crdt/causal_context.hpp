@@ -0,0 +1,104 @@
+#ifndef CAUSAL_CONTEXT_HPP
+#define CAUSAL_CONTEXT_HPP
+
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <msgpack.hpp>
+
+#include "dot.hpp"
+
+using namespace std;
+
+// Every dot a replica has seen: a version vector for the contiguous prefix
+// per replica plus a cloud of dots that arrived out of order. The cloud is
+// folded into the vector as soon as the gaps fill, so it stays small.
+class CausalContext {
+private:
+    unordered_map<uint64_t, uint64_t> vv;
+    unordered_set<Dot> cloud;
+
+public:
+    CausalContext() = default;
+
+    bool contains(const Dot& d) const {
+        auto it = vv.find(d.replica);
+        if (it != vv.end() && d.counter <= it->second) return true;
+        return cloud.find(d) != cloud.end();
+    }
+
+    // Issues the next dot of a replica and records it as seen
+    Dot next(uint64_t replica) {
+        return Dot{replica, ++vv[replica]};
+    }
+
+    void insert(const Dot& d) {
+        if (contains(d)) return;
+        cloud.insert(d);
+        compact();
+    }
+
+    // Records every dot of a replica up to counter as seen
+    void insert_upto(uint64_t replica, uint64_t counter) {
+        uint64_t& mine = vv[replica];
+        if (counter <= mine) return;
+        mine = counter;
+        compact();
+    }
+
+    // Returns true if the other context held dots this one had not seen
+    bool merge(const CausalContext& other) {
+        bool changed = false;
+        for (const auto& [replica, counter] : other.vv) {
+            uint64_t& mine = vv[replica];
+            if (counter > mine) {
+                mine = counter;
+                changed = true;
+            }
+        }
+        for (const auto& d : other.cloud) {
+            if (!contains(d)) {
+                cloud.insert(d);
+                changed = true;
+            }
+        }
+        compact();
+        return changed;
+    }
+
+    size_t approx_size() const {
+        return sizeof(*this) + vv.size() * 2 * sizeof(uint64_t) + cloud.size() * sizeof(Dot);
+    }
+
+    uint64_t digest() const {
+        uint64_t h = 0;
+        for (const auto& [replica, counter] : vv)
+            h += Util::mix64(replica ^ Util::mix64(counter));
+        for (const auto& d : cloud)
+            h += Util::mix64(~d.replica ^ Util::mix64(d.counter));
+        return h;
+    }
+
+    MSGPACK_DEFINE(vv, cloud);
+
+private:
+    void compact() {
+        bool progress = true;
+        while (progress && !cloud.empty()) {
+            progress = false;
+            for (auto it = cloud.begin(); it != cloud.end(); ) {
+                auto vit = vv.find(it->replica);
+                uint64_t top = vit == vv.end() ? 0 : vit->second;
+                if (it->counter <= top + 1) {
+                    vv[it->replica] = max(top, it->counter);
+                    it = cloud.erase(it);
+                    progress = true;
+                } else {
+                    ++it;
+                }
+            }
+        }
+    }
+};
+
+#endif
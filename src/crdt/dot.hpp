@@ -0,0 +1,38 @@
+#ifndef DOT_HPP
+#define DOT_HPP
+
+#include <cstdint>
+#include <string>
+#include <functional>
+#include <msgpack.hpp>
+
+#include "../util.hpp"
+
+using namespace std;
+
+// A single event: the counter-th operation issued by a replica
+struct Dot {
+    uint64_t replica = 0;
+    uint64_t counter = 0;
+
+    bool operator==(const Dot& other) const {
+        return replica == other.replica && counter == other.counter;
+    }
+
+    static uint64_t replica_id(const string& origin) {
+        return Util::hash64(origin);
+    }
+
+    MSGPACK_DEFINE(replica, counter);
+};
+
+namespace std {
+    template<>
+    struct hash<Dot> {
+        size_t operator()(const Dot& d) const noexcept {
+            return Util::mix64(d.replica ^ Util::mix64(d.counter));
+        }
+    };
+}
+
+#endif
@@ -3,26 +3,31 @@
 #include <unordered_set>
 #include <string>
 #include <vector>
-#include <chrono>
 #include <algorithm>
 #include <msgpack.hpp>
 
+#include "dot.hpp"
+#include "causal_context.hpp"
+
 using namespace std;
 
+// Add-wins observed-remove set built on dots. Only live elements keep their
+// dots; a remove simply drops them, and the causal context remembers that they
+// were seen, so no tombstones are stored and merge work follows the live set.
 template <typename T>
 class ORSet {
 private:
-    unordered_map<string, T> elements; // TOOD: rethink if this is really needed
-    unordered_map<string, unordered_set<string>> addSet;
-    unordered_map<string, unordered_set<string>> removeSet;
-
-    string genTag() const {
-        using namespace chrono;
-        auto now = duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
-        return to_string(now);
-    }
+    unordered_map<string, T> elements;
+    unordered_map<string, unordered_set<Dot>> dots;
+    CausalContext context;
 
 public:
+    // Encoding version, packed ahead of the fields. Sets packed before it
+    // existed start with the elements map instead: with three fields they
+    // tagged adds with timestamp strings, with four or five with dots, and
+    // both kept removed tags as tombstones. Those decode into the dot store.
+    static constexpr uint32_t FORMAT = 2;
+
     ORSet() = default;
 
     bool contains(const T &elem) const {
@@ -30,71 +35,205 @@ public:
     }
 
     bool contains(const string &uid) const {
-        auto it = addSet.find(uid);
-        if (it == addSet.end()) return false;
-
-        auto rit = removeSet.find(uid);
-        if (rit == removeSet.end()) return true;
-
-        for (auto &tag : it->second)
-            if (rit->second.find(tag) == rit->second.end())
-                return true;
-        return false;
+        return dots.find(uid) != dots.end();
     }
 
-    void add(const T &elem) {
+    // A fresh dot supersedes every dot of the element this replica observed.
+    // Dots are unique as long as origins are: each replica counts its own.
+    void add(const string &origin, const T &elem) {
         const string uid = elem.getUid();
+        Dot d = context.next(Dot::replica_id(origin));
         elements[uid] = elem;
-        addSet[uid].insert(genTag());
+        dots[uid] = {d};
     }
 
     void remove(const T &elem) {
         const string uid = elem.getUid();
-        auto it = addSet.find(uid);
-        if (it != addSet.end()) {
-            for (auto &tag : it->second)
-                removeSet[uid].insert(tag);
-        }
+        dots.erase(uid);
+        elements.erase(uid);
+    }
+
+    // Live element with the given uid, nullptr if absent or removed
+    T* find(const string &uid) {
+        auto it = elements.find(uid);
+        return it == elements.end() ? nullptr : &it->second;
+    }
+
+    const T* find(const string &uid) const {
+        auto it = elements.find(uid);
+        return it == elements.end() ? nullptr : &it->second;
     }
 
     vector<T*> values() {
         vector<T*> elems;
-        for (auto &p : addSet) {
-            const string &uid = p.first;
-            if (contains(uid)) {
-                auto it = elements.find(uid);
-                if (it != elements.end()) elems.push_back(&it->second);
-            }
-        }
+        elems.reserve(elements.size());
+        for (auto &p : elements)
+            elems.push_back(&p.second);
         return elems;
     }
 
     vector<const T*> values() const {
         vector<const T*> elems;
-        for (auto &p : addSet) {
-            const string &uid = p.first;
-            if (contains(uid)) {
-                auto it = elements.find(uid);
-                if (it != elements.end()) elems.push_back(&it->second);
+        elems.reserve(elements.size());
+        for (auto &p : elements)
+            elems.push_back(&p.second);
+        return elems;
+    }
+
+    // A dot survives if both sides have it, or if the side lacking it has
+    // never seen it. Returns true if merging changed this set's state.
+    bool merge(const ORSet<T> &other) {
+        bool changed = false;
+
+        // Our dots the other side saw and dropped were removed there
+        for (auto it = dots.begin(); it != dots.end(); ) {
+            auto oit = other.dots.find(it->first);
+            for (auto dit = it->second.begin(); dit != it->second.end(); ) {
+                bool theyHave = oit != other.dots.end() && oit->second.count(*dit);
+                if (!theyHave && other.context.contains(*dit)) {
+                    dit = it->second.erase(dit);
+                    changed = true;
+                } else {
+                    ++dit;
+                }
+            }
+
+            if (it->second.empty()) {
+                elements.erase(it->first);
+                it = dots.erase(it);
+            } else {
+                ++it;
             }
         }
-        return elems;
+
+        // Their dots we never saw are new adds; ones we saw and lack we removed
+        for (auto &[uid, theirDots] : other.dots) {
+            auto theirs = other.elements.find(uid);
+            if (theirs == other.elements.end()) continue;
+
+            bool added = false;
+            for (auto &d : theirDots) {
+                if (context.contains(d)) continue;
+                dots[uid].insert(d);
+                added = true;
+            }
+
+            if (dots.find(uid) == dots.end()) continue;
+
+            auto elem = elements.find(uid);
+            if (elem == elements.end()) {
+                elements.emplace(uid, theirs->second);
+                changed = true;
+            } else {
+                changed |= elem->second.merge(theirs->second);
+            }
+            changed |= added;
+        }
+
+        changed |= context.merge(other.context);
+        return changed;
     }
 
-    void merge(const ORSet<T> &other) {
-        for (auto &p : other.elements) {
-            if (elements.find(p.first) != elements.end())
-                elements[p.first] = elements[p.first].merge(p.second);
-            else
-                elements[p.first] = p.second;
+    // Rough heap footprint for cache accounting; element payloads count as sizeof(T)
+    size_t approx_size() const {
+        size_t bytes = sizeof(*this) + context.approx_size();
+        for (auto &[uid, elem] : elements)
+            bytes += uid.size() + sizeof(T);
+        for (auto &[uid, ds] : dots)
+            bytes += uid.size() + ds.size() * sizeof(Dot);
+        return bytes;
+    }
+
+    // Order-independent hash of elements, dots and context, equal on
+    // replicas that converged
+    uint64_t digest() const {
+        uint64_t h = context.digest();
+        for (auto &[uid, elem] : elements)
+            h += Util::mix64(Util::hash64(uid) ^ elem.digest());
+
+        for (auto &[uid, ds] : dots) {
+            uint64_t u = Util::hash64(uid);
+            for (auto &d : ds)
+                h += Util::mix64(u + hash<Dot>()(d));
         }
+        return h;
+    }
 
-        for (auto &[uid, tags] : other.addSet)
-            addSet[uid].insert(tags.begin(), tags.end());
+    template <typename Packer>
+    void msgpack_pack(Packer &pk) const {
+        pk.pack_array(4);
+        pk.pack(FORMAT);
+        pk.pack(elements);
+        pk.pack(dots);
+        pk.pack(context);
+    }
 
-        for (auto &[uid, tags] : other.removeSet)
-            removeSet[uid].insert(tags.begin(), tags.end());
+    void msgpack_unpack(const msgpack::object &o) {
+        if (o.type != msgpack::type::ARRAY || o.via.array.size == 0) throw msgpack::type_error();
+        const msgpack::object *fields = o.via.array.ptr;
+        uint32_t count = o.via.array.size;
+
+        *this = ORSet<T>();
+        if (fields[0].type == msgpack::type::MAP) {
+            unpack_legacy(fields, count);
+            return;
+        }
+        if (count != 4 || fields[0].as<uint32_t>() != FORMAT) throw msgpack::type_error();
+        fields[1].convert(elements);
+        fields[2].convert(dots);
+        fields[3].convert(context);
     }
 
-    MSGPACK_DEFINE(elements, addSet, removeSet);
+private:
+    void unpack_legacy(const msgpack::object *fields, uint32_t count) {
+        if (count < 3 || count > 5) throw msgpack::type_error();
+        fields[0].convert(elements);
+
+        if (count == 3) {
+            // A timestamp tag becomes a dot of its own replica, derived from
+            // the tag alone so every replica converting it gets the same dot
+            unpack_tags<string>(fields[1], fields[2], [](const string &uid, const string &tag) {
+                return Dot{Dot::replica_id(uid + "#" + tag), 1};
+            });
+        } else {
+            // A replica's counter (and collected floor) only moved past dots
+            // it had merged, so every dot up to it was seen
+            for (uint32_t i = 3; i < count; i++) {
+                unordered_map<uint64_t, uint64_t> seen;
+                fields[i].convert(seen);
+                for (auto &[replica, counter] : seen)
+                    context.insert_upto(replica, counter);
+            }
+            unpack_tags<Dot>(fields[1], fields[2], [](const string &, const Dot &tag) {
+                return tag;
+            });
+        }
+
+        for (auto it = elements.begin(); it != elements.end(); ) {
+            if (dots.find(it->first) == dots.end()) it = elements.erase(it);
+            else ++it;
+        }
+    }
+
+    // Add tags not in the remove set stay as live dots; every tag is seen
+    template <typename Tag, typename ToDot>
+    void unpack_tags(const msgpack::object &addObj, const msgpack::object &removeObj, ToDot toDot) {
+        unordered_map<string, unordered_set<Tag>> added, removed;
+        addObj.convert(added);
+        removeObj.convert(removed);
+
+        for (auto &[uid, tags] : removed)
+            for (auto &tag : tags)
+                context.insert(toDot(uid, tag));
+
+        for (auto &[uid, tags] : added) {
+            auto rit = removed.find(uid);
+            for (auto &tag : tags) {
+                Dot d = toDot(uid, tag);
+                context.insert(d);
+                if (rit == removed.end() || rit->second.find(tag) == rit->second.end())
+                    dots[uid].insert(d);
+            }
+        }
+    }
 };
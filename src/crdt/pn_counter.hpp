@@ -5,6 +5,8 @@
 #include <string>
 #include <msgpack.hpp>
 
+#include "../util.hpp"
+
 using namespace std;
 
 class PNCounter {
@@ -40,13 +42,36 @@ public:
         return pos_sum - neg_sum;
     }
 
-    void merge(const PNCounter& other) {
+    // Returns true if any entry grew, i.e. this counter learned something new.
+    bool merge(const PNCounter& other) {
+        bool changed = false;
         for (const auto& [origin, count] : other.pos) {
-            pos[origin] = max(pos[origin], count);
+            uint64_t& mine = pos[origin];
+            if (count > mine) {
+                mine = count;
+                changed = true;
+            }
         }
         for (const auto& [origin, count] : other.neg) {
-            neg[origin] = max(neg[origin], count);
+            uint64_t& mine = neg[origin];
+            if (count > mine) {
+                mine = count;
+                changed = true;
+            }
+        }
+        return changed;
+    }
+
+    // Order-independent hash of the full state, equal on replicas that converged
+    uint64_t digest() const {
+        uint64_t h = 0;
+        for (const auto& [origin, count] : pos) {
+            h += Util::mix64(Util::hash64(origin) ^ count);
+        }
+        for (const auto& [origin, count] : neg) {
+            h += Util::mix64(~Util::hash64(origin) ^ count);
         }
+        return h;
     }
 
     MSGPACK_DEFINE(pos, neg);
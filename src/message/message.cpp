@@ -1,6 +1,7 @@
 #include "message.hpp"
 #include <msgpack.hpp>
 #include <cstring>
+#include <cstdlib>
 
 namespace message
 {
@@ -87,20 +88,89 @@ namespace message
         return m;
     }
 
+    Message Message::digest_nodes(const std::string& origin, uint64_t ts,
+                                  const std::vector<DigestEntry>& digests)
+    {
+        Message m;
+        m.op = OpType::DIGEST_NODES;
+        m.origin = origin;
+        m.ts = ts;
+        m.digests = digests;
+        return m;
+    }
+
+    Message Message::digest_leaves(const std::string& origin, uint64_t ts,
+                                   const std::vector<DigestEntry>& digests,
+                                   const std::vector<ShoppingList>& lists)
+    {
+        Message m;
+        m.op = OpType::DIGEST_LEAVES;
+        m.origin = origin;
+        m.ts = ts;
+        m.digests = digests;
+        m.lists = lists;
+        return m;
+    }
+
+    Message Message::migrate_lists(const std::string& origin, uint64_t ts,
+                                   const std::vector<ShoppingList>& lists)
+    {
+        Message m;
+        m.op = OpType::MIGRATE_LISTS;
+        m.origin = origin;
+        m.ts = ts;
+        m.lists = lists;
+        return m;
+    }
+
+    Message Message::migrate_ack(const std::string& origin, uint64_t ts,
+                                 const std::vector<DigestEntry>& digests)
+    {
+        Message m;
+        m.op = OpType::MIGRATE_ACK;
+        m.origin = origin;
+        m.ts = ts;
+        m.digests = digests;
+        return m;
+    }
+
+    // sbuffer allocates with malloc, so ZeroMQ frees it the same way
+    static void free_packed(void *data, void *)
+    {
+        std::free(data);
+    }
+
+    // Strings and blobs are converted right after unpacking, so the object
+    // can point into the frame instead of copying them into the zone first
+    static bool reference_frame(msgpack::type::object_type, std::size_t, void *)
+    {
+        return true;
+    }
+
     zmq::message_t Message::to_zmq() const
     {
         msgpack::sbuffer buf;
         msgpack::pack(buf, *this);
-        zmq::message_t fm(buf.size());
-        std::memcpy(fm.data(), buf.data(), buf.size());
-        return fm;
+        size_t size = buf.size();
+        // The frame takes over the packed bytes instead of copying them
+        return zmq::message_t(buf.release(), size, free_packed, nullptr);
     }
 
     Message Message::from_zmq(const zmq::message_t &frame)
     {
-        auto oh = msgpack::unpack(static_cast<const char *>(frame.data()), frame.size());
+        // One zone per thread, cleared after every message, keeps its chunks
+        // instead of allocating a fresh zone for each frame
+        thread_local msgpack::zone zone;
         Message m;
-        oh.get().convert(m);
+        try {
+            msgpack::object obj = msgpack::unpack(zone, static_cast<const char *>(frame.data()), frame.size(),
+                                                  reference_frame);
+            obj.convert(m);
+        } catch (...) {
+            zone.clear();
+            throw;
+        }
+        zone.clear();
         return m;
     }
 
@@ -6,6 +6,7 @@
 #include <msgpack.hpp>
 #include "../model/shopping_list.hpp"
 #include "../model/shopping_item.hpp"
+#include "../util.hpp"
 #include <zmq.hpp>
 
 namespace message
@@ -21,7 +22,11 @@ namespace message
         GOSSIP_LISTS = 6,
         GOSSIP_NODES = 7,
         GET_NODES = 8,
-        NODES_RESPONSE = 9
+        NODES_RESPONSE = 9,
+        DIGEST_NODES = 10,
+        DIGEST_LEAVES = 11,
+        MIGRATE_LISTS = 12,
+        MIGRATE_ACK = 13
     };
 
     struct NodeInfo {
@@ -32,8 +37,25 @@ namespace message
         int gossipPullPort;
         int discoveryPullPort;
         uint64_t lastSeenTs = 0;
+        uint32_t shardWeight = 1; // share of the hash ring owned by the node's shard, 0 while it joins
+        uint8_t placementHash = static_cast<uint8_t>(HashVersion::WYHASH); // HashVersion of the ring
 
-        MSGPACK_DEFINE(nodeId, host, shardId, clientPort, gossipPullPort, discoveryPullPort, lastSeenTs);
+        MSGPACK_DEFINE(nodeId, host, shardId, clientPort, gossipPullPort, discoveryPullPort, lastSeenTs,
+                       shardWeight, placementHash);
+    };
+
+    // DIGEST_NODES carries (node, hash) pairs of the sender's Merkle tree.
+    // DIGEST_LEAVES carries (leaf, hash, listId) for every list under the
+    // listed leaves; an empty listId marks a leaf the sender has no lists in.
+    // It may also carry the sender's version of lists it found divergent.
+    // MIGRATE_ACK carries (0, hash, listId) for every list of a MIGRATE_LISTS
+    // batch the new shard has durably merged, hash being the sent digest.
+    struct DigestEntry {
+        uint32_t node;
+        uint64_t hash;
+        std::string listId;
+
+        MSGPACK_DEFINE(node, hash, listId);
     };
 
     struct Message
@@ -43,8 +65,9 @@ namespace message
         uint64_t ts;
         std::vector<ShoppingList> lists;
         std::vector<NodeInfo> nodes;
+        std::vector<DigestEntry> digests;
 
-        MSGPACK_DEFINE(op, origin, ts, lists, nodes);
+        MSGPACK_DEFINE(op, origin, ts, lists, nodes, digests);
 
         static Message ensure_list(const std::string& origin, uint64_t ts,
                                    const ShoppingList& list);
@@ -68,6 +91,19 @@ namespace message
         static Message nodes_response(const std::string& origin, uint64_t ts,
                                       const std::vector<NodeInfo>& nodes);
 
+        static Message digest_nodes(const std::string& origin, uint64_t ts,
+                                    const std::vector<DigestEntry>& digests);
+
+        static Message digest_leaves(const std::string& origin, uint64_t ts,
+                                     const std::vector<DigestEntry>& digests,
+                                     const std::vector<ShoppingList>& lists);
+
+        static Message migrate_lists(const std::string& origin, uint64_t ts,
+                                     const std::vector<ShoppingList>& lists);
+
+        static Message migrate_ack(const std::string& origin, uint64_t ts,
+                                   const std::vector<DigestEntry>& digests);
+
         zmq::message_t to_zmq() const;
         static Message from_zmq(const zmq::message_t &frame);
     };
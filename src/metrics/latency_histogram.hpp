@@ -0,0 +1,58 @@
+#ifndef LATENCY_HISTOGRAM_HPP
+#define LATENCY_HISTOGRAM_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Latency distribution in microseconds with power-of-two buckets: bucket b
+// counts samples in [2^(b-1), 2^b). Recording is one relaxed increment, so
+// any thread may record while another reads percentiles; these are upper
+// bounds of the bucket the percentile falls into.
+class LatencyHistogram {
+public:
+    static constexpr size_t BUCKETS = 40;
+
+    void record(uint64_t micros) {
+        size_t b = 0;
+        while (b + 1 < BUCKETS && micros >= (1ULL << b)) b++;
+        buckets[b].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const {
+        uint64_t total = 0;
+        for (auto& b : buckets) total += b.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    uint64_t percentile(double p) const {
+        std::array<uint64_t, BUCKETS> snapshot;
+        uint64_t total = 0;
+        for (size_t i = 0; i < BUCKETS; i++) {
+            snapshot[i] = buckets[i].load(std::memory_order_relaxed);
+            total += snapshot[i];
+        }
+        if (total == 0) return 0;
+
+        uint64_t rank = static_cast<uint64_t>(p * (total - 1)) + 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; i++) {
+            seen += snapshot[i];
+            if (seen >= rank) return 1ULL << i;
+        }
+        return 1ULL << (BUCKETS - 1);
+    }
+
+    // "n=... p50=...us p99=...us"
+    std::string summary() const {
+        return "n=" + std::to_string(count()) +
+            " p50=" + std::to_string(percentile(0.50)) + "us" +
+            " p99=" + std::to_string(percentile(0.99)) + "us";
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKETS> buckets{};
+};
+
+#endif
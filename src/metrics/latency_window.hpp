@@ -0,0 +1,49 @@
+#ifndef LATENCY_WINDOW_HPP
+#define LATENCY_WINDOW_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <mutex>
+
+// The last SIZE latency samples in microseconds, for percentiles that have
+// to follow the current state of the cluster rather than its whole history.
+// Percentiles are exact over the window; reading one sorts a copy of it.
+template <size_t SIZE>
+class LatencyWindow {
+public:
+    void record(uint64_t micros) {
+        std::lock_guard<std::mutex> g(mtx);
+        samples[next] = micros;
+        next = (next + 1) % SIZE;
+        if (filled < SIZE) filled++;
+    }
+
+    uint64_t count() const {
+        std::lock_guard<std::mutex> g(mtx);
+        return filled;
+    }
+
+    uint64_t percentile(double p) const {
+        std::array<uint64_t, SIZE> sorted;
+        size_t n;
+        {
+            std::lock_guard<std::mutex> g(mtx);
+            n = filled;
+            std::copy(samples.begin(), samples.begin() + n, sorted.begin());
+        }
+        if (n == 0) return 0;
+
+        size_t rank = static_cast<size_t>(p * (n - 1));
+        std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.begin() + n);
+        return sorted[rank];
+    }
+
+private:
+    mutable std::mutex mtx;
+    std::array<uint64_t, SIZE> samples{};
+    size_t next = 0;
+    size_t filled = 0;
+};
+
+#endif
@@ -49,14 +49,21 @@ void ShoppingItem::setName(const string& name) {
     this -> name = name;
 }
 
-ShoppingItem& ShoppingItem::merge(const ShoppingItem &other) {
+bool ShoppingItem::merge(const ShoppingItem &other) {
     if (this->uid != other.uid) {
         throw invalid_argument("Cannot merge ShoppingItems with different UIDs");
     }
+    bool changed = this->name != other.name;
     this->name = other.name;
-    this->desiredQuantity.merge(other.desiredQuantity);
-    this->currentQuantity.merge(other.currentQuantity);
-    return *this;
+    changed |= this->desiredQuantity.merge(other.desiredQuantity);
+    changed |= this->currentQuantity.merge(other.currentQuantity);
+    return changed;
+}
+
+uint64_t ShoppingItem::digest() const {
+    return Util::mix64(Util::hash64(uid) ^ Util::hash64(name))
+        + Util::mix64(desiredQuantity.digest() ^ 1)
+        + Util::mix64(currentQuantity.digest() ^ 2);
 }
 
 json ShoppingItem::to_json(const ShoppingItem& it) {
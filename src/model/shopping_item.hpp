@@ -30,7 +30,8 @@ class ShoppingItem {
         void setDesiredQuantity(string origin, uint32_t quantity);
         void setName(const string& name);
 
-        ShoppingItem& merge(const ShoppingItem &other);
+        bool merge(const ShoppingItem &other);
+        uint64_t digest() const;
 
         MSGPACK_DEFINE(uid, name, desiredQuantity, currentQuantity);
         static nlohmann::json to_json(const ShoppingItem& it);
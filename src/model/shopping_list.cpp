@@ -11,18 +11,18 @@ string ShoppingList::getUid() const {
     return uid;
 }
 
-void ShoppingList::add(const ShoppingItem& item) {
+void ShoppingList::add(const string& origin, const ShoppingItem& item) {
     if (this -> contains(item)) {
         throw invalid_argument("Item with the same UID already exists in the shopping list");
     }
-    items.add(item);
+    items.add(origin, item);
 }
 
-void ShoppingList::update(const ShoppingItem& item) {
+void ShoppingList::update(const string& origin, const ShoppingItem& item) {
     if (!this -> contains(item)) {
         throw invalid_argument("Item not found in the shopping list");
     }
-    items.add(item);
+    items.add(origin, item);
 }
 
 void ShoppingList::remove(const ShoppingItem& item) {
@@ -34,21 +34,19 @@ bool ShoppingList::contains(const ShoppingItem& item) const {
 }
 
 ShoppingItem& ShoppingList::getItem(const string& uid) {
-    for (auto* it : items.values()) {
-        if (it->getUid() == uid) { // TODO: rethink and rework so we don't have linear search!
-            return *it;
-        }
+    ShoppingItem* item = items.find(uid);
+    if (!item) {
+        throw invalid_argument("Item not found in the shopping list");
     }
-    throw invalid_argument("Item not found in the shopping list");
+    return *item;
 }
 
 const ShoppingItem& ShoppingList::getItem(const string& uid) const {
-    for (auto* it : items.values()) {
-        if (it->getUid() == uid) {
-            return *it;
-        }
+    const ShoppingItem* item = items.find(uid);
+    if (!item) {
+        throw invalid_argument("Item not found in the shopping list");
     }
-    throw invalid_argument("Item not found in the shopping list");
+    return *item;
 }
 
 vector<ShoppingItem*> ShoppingList::getAllItems() {
@@ -67,6 +65,14 @@ json to_json(const ShoppingList& list) {
     return json{{"items", items}, {"uid", list.uid}, {"name", list.name}};
 }
 
-void ShoppingList::merge(const ShoppingList &other) {
-    this->items.merge(other.items);
-}
\ No newline at end of file
+bool ShoppingList::merge(const ShoppingList &other) {
+    return this->items.merge(other.items);
+}
+
+// The name is left out on purpose: merge() does not converge it between replicas
+uint64_t ShoppingList::digest() const {
+    return Util::mix64(Util::hash64(uid)) + items.digest();
+}
+size_t ShoppingList::approx_size() const {
+    return sizeof(*this) + uid.size() + name.size() + items.approx_size();
+}
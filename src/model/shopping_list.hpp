@@ -23,8 +23,8 @@ class ShoppingList {
         ShoppingList() = default;
         string getUid() const;
         ShoppingList(string uid, string name);
-        void add(const ShoppingItem& item);
-        void update(const ShoppingItem& item);
+        void add(const string& origin, const ShoppingItem& item);
+        void update(const string& origin, const ShoppingItem& item);
         void remove(const ShoppingItem& item);
         bool contains(const ShoppingItem& item) const;
         ShoppingItem& getItem(const string& uid);
@@ -32,7 +32,9 @@ class ShoppingList {
         vector<ShoppingItem*> getAllItems();
         vector<const ShoppingItem*> getAllItems() const;
         friend nlohmann::json to_json(const ShoppingList& lst);
-        void merge(const ShoppingList &other);
+        bool merge(const ShoppingList &other);
+        uint64_t digest() const;
+        size_t approx_size() const;
 
         MSGPACK_DEFINE(uid, name, items);
     };
@@ -1,6 +1,6 @@
 #include "node.hpp"
 #include "../message/message.hpp"
-#include "../util.cpp"
+#include "../util.hpp"
 #include <thread>
 #include <chrono>
 #include <iostream>
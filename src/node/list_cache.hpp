@@ -0,0 +1,124 @@
+#ifndef LIST_CACHE_HPP
+#define LIST_CACHE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../model/shopping_list.hpp"
+
+// LRU cache of deserialized lists bounded by an approximate byte budget.
+// Entries are write-back: a dirty list reaches the db only when it is evicted
+// (handed back by put) or collected with take_dirty. Not thread safe; only
+// the hit and miss counters may be read from other threads.
+class ListCache {
+public:
+    explicit ListCache(size_t budgetBytes): budget(budgetBytes) {}
+
+    // Cached list or nullptr; the pointer stays valid until the next put or erase
+    ShoppingList* get(const std::string& listId) {
+        auto it = index.find(listId);
+        if (it == index.end()) {
+            misses++;
+            return nullptr;
+        }
+        hits++;
+        entries.splice(entries.begin(), entries, it->second);
+        return &it->second->list;
+    }
+
+    // Inserts or replaces a list and returns the dirty lists evicted to stay
+    // within budget, which the caller must write out
+    std::vector<ShoppingList> put(ShoppingList list, bool dirty) {
+        std::string id = list.getUid();
+        size_t size = list.approx_size();
+
+        auto it = index.find(id);
+        if (it != index.end()) {
+            Entry& e = *it->second;
+            bytes -= e.size;
+            e.list = std::move(list);
+            e.size = size;
+            e.dirty = e.dirty || dirty;
+            entries.splice(entries.begin(), entries, it->second);
+        } else {
+            entries.push_front(Entry{std::move(list), size, dirty});
+            index[id] = entries.begin();
+        }
+        bytes += size;
+
+        std::vector<ShoppingList> evicted;
+        while (bytes > budget && !entries.empty()) {
+            Entry& victim = entries.back();
+            bytes -= victim.size;
+            index.erase(victim.list.getUid());
+            if (victim.dirty) evicted.push_back(std::move(victim.list));
+            entries.pop_back();
+        }
+        return evicted;
+    }
+
+    void erase(const std::string& listId) {
+        auto it = index.find(listId);
+        if (it == index.end()) return;
+        bytes -= it->second->size;
+        entries.erase(it->second);
+        index.erase(it);
+    }
+
+    // Copies of all dirty lists; they count as clean from now on
+    std::vector<ShoppingList> take_dirty() {
+        std::vector<ShoppingList> dirty;
+        for (auto& e : entries) {
+            if (!e.dirty) continue;
+            dirty.push_back(e.list);
+            e.dirty = false;
+        }
+        return dirty;
+    }
+
+    // Puts lists back into the dirty state after a failed write
+    void mark_dirty(const std::vector<ShoppingList>& lists) {
+        for (auto& list : lists) {
+            auto it = index.find(list.getUid());
+            if (it != index.end()) it->second->dirty = true;
+        }
+    }
+
+    // Takes back lists whose write was lost after they were handed out as
+    // dirty. Each is merged with the cached copy, which may be newer, and
+    // becomes dirty again. Returns the dirty lists evicted meanwhile, like put.
+    std::vector<ShoppingList> restore(const std::vector<ShoppingList>& lists) {
+        std::vector<ShoppingList> evicted;
+        for (auto& list : lists) {
+            ShoppingList merged = list;
+            auto it = index.find(list.getUid());
+            if (it != index.end()) merged.merge(it->second->list);
+            for (auto& e : put(std::move(merged), true))
+                evicted.push_back(std::move(e));
+        }
+        return evicted;
+    }
+
+    uint64_t hit_count() const { return hits; }
+    uint64_t miss_count() const { return misses; }
+
+private:
+    struct Entry {
+        ShoppingList list;
+        size_t size;
+        bool dirty;
+    };
+
+    size_t budget;
+    size_t bytes = 0;
+    std::list<Entry> entries; // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+};
+
+#endif
@@ -2,26 +2,56 @@
 #include <iostream>
 #include <chrono>
 #include <cstring>
+#include <algorithm>
 
-#include "util.cpp"
+#include "util.hpp"
 
 using namespace message;
 using namespace std;
 
+// Scoped lock on stateMutex that records how long it was waited for and
+// held, so contention between client serving and gossip shows in the report
+struct TimedLock {
+    unique_lock<mutex> lk;
+    LatencyHistogram* held;
+    uint64_t acquiredUs;
+
+    TimedLock(mutex& m, LatencyHistogram* waited, LatencyHistogram* heldFor)
+    : lk(m, defer_lock), held(heldFor) {
+        uint64_t start = Util::now_us();
+        lk.lock();
+        acquiredUs = Util::now_us();
+        if (waited) waited->record(acquiredUs - start);
+    }
+
+    ~TimedLock() {
+        if (held) held->record(Util::now_us() - acquiredUs);
+    }
+};
+
 Node::Node(const NodeConfig& c)
 : cfg(c),
+  ring(HashRing::with_shards(c.numShards, c.shardWeights, c.placementHash)),
   ctx(1),
-  repSock(ctx, ZMQ_REP),
+  routerSock(ctx, ZMQ_ROUTER),
+  replyPullSock(ctx, ZMQ_PULL),
   gossipPushSock(ctx, ZMQ_PUSH),
   gossipPullSock(ctx, ZMQ_PULL),
   discoveryPushSock(ctx, ZMQ_PUSH),
   discoveryPullSock(ctx, ZMQ_PULL),
-  db()
+  db(),
+  cache(c.cacheBudgetBytes),
+  migrationPushSock(ctx, ZMQ_PUSH)
 {
-    if (!db.init_db(cfg.dbPath)) {
+    if (!db.init_db(cfg.dbPath, cfg.durability)) {
         cerr << "[Node " << cfg.nodeId << "] failed to init db: " << cfg.dbPath << "\n";
+    } else {
+        cout << "[Node " << cfg.nodeId << "] db " << cfg.dbPath << " " << db.durability_summary() << "\n";
     }
+    // Lists stored before this start are reconciled by full-state rounds
+    gossipCursor = db.last_seq();
 
+    auto ownWeight = ring.shards().find(cfg.shardId);
     knownNodes[cfg.nodeId] = NodeInfo{
         cfg.nodeId,
         cfg.host,
@@ -29,11 +59,14 @@ Node::Node(const NodeConfig& c)
         cfg.clientPort,
         cfg.gossipPullPort,
         cfg.discoveryPullPort,
-        Util::now_ms()
+        Util::now_ms(),
+        cfg.joining ? 0u : ownWeight == ring.shards().end() ? 1u : ownWeight->second,
+        static_cast<uint8_t>(cfg.placementHash)
     };
 
     string repAddr = "tcp://" + cfg.host + ":" + to_string(cfg.clientPort);
-    repSock.bind(repAddr);
+    routerSock.bind(repAddr);
+    replyPullSock.bind("inproc://client-replies");
 
     {
         std::string addr = "tcp://" + cfg.host + ":" + std::to_string(cfg.gossipPullPort);
@@ -50,30 +83,90 @@ Node::Node(const NodeConfig& c)
 
 Node::~Node() {
     stop();
-    repSock.close();
+    routerSock.close();
+    replyPullSock.close();
     gossipPushSock.close();
     gossipPullSock.close();
     discoveryPullSock.close();
     discoveryPushSock.close();
+    migrationPushSock.close();
+    for (auto& [_, sock] : nodeSocks)
+        sock.close();
     ctx.close();
 }
 
 void Node::start() {
     if (running) return;
     running = true;
-    loopThread = thread(&Node::run_loop, this);
+
+    update_known_nodes(cfg.initialPeers);
+    {
+        lock_guard<mutex> lk(nodesMutex);
+        for (auto& [nodeId, info] : knownNodes)
+            info.lastSeenTs = Util::now_ms();
+    }
+
+    for (int i = 0; i < cfg.clientWorkers; i++)
+        workers.push_back(make_unique<ClientWorker>());
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i]->thread = thread(&Node::worker_loop, this, i);
+    if (cfg.threading == ThreadingMode::SPLIT) {
+        gossipThread = thread(&Node::gossip_loop, this);
+        discoveryThread = thread(&Node::discovery_loop, this);
+        loopThread = thread(&Node::client_loop, this);
+    } else {
+        loopThread = thread(&Node::run_loop, this);
+    }
 }
 
 void Node::stop() {
     if (!running) return;
     running = false;
+    for (auto& w : workers) {
+        lock_guard<mutex> lk(w->mtx);
+        w->cv.notify_all();
+    }
     ctx.shutdown();
-    if (loopThread.joinable())
-        loopThread.join();
+    // The client thread hands jobs to the workers, so it goes first
+    for (thread* t : {&loopThread, &gossipThread, &discoveryThread}) {
+        if (t->joinable())
+            t->join();
+    }
+    for (auto& w : workers) {
+        if (w->thread.joinable())
+            w->thread.join();
+    }
+    workers.clear();
+
+    lock_guard<mutex> lk(stateMutex);
+    flush_cache();
+    if (!db.flush(true))
+        cerr << "[Node " << cfg.nodeId << "] final commit failed, recent writes are lost\n";
+}
+
+uint64_t Node::cache_hits() const {
+    return cache.hit_count();
+}
+
+uint64_t Node::cache_misses() const {
+    return cache.miss_count();
+}
+
+string Node::latency_report() const {
+    return "client[" + clientLatency.summary() + "]" +
+        " clientLockWait[" + clientLockWait.summary() + "]" +
+        " gossip[" + gossipLatency.summary() + "]" +
+        " gossipLockHold[" + gossipLockHold.summary() + "]" +
+        " discovery[" + discoveryLatency.summary() + "]";
 }
 
 int Node::shard_for_list(const string& listId) const {
-    return Util::getHash(listId) % cfg.numShards;
+    shared_lock<shared_mutex> lk(ringMutex);
+    return ring.shard_for(listId);
+}
+
+bool Node::owns_list(const string& listId) const {
+    return shard_for_list(listId) == cfg.shardId;
 }
 
 void Node::run_loop() {
@@ -81,45 +174,64 @@ void Node::run_loop() {
     uint64_t nextDiscoveryGossipTs = next_gossip_ts(cfg.discoveryIntervalMs);
 
     zmq::pollitem_t items[] = {
-        { static_cast<void*>(repSock), 0, ZMQ_POLLIN, 0 },
+        { static_cast<void*>(routerSock), 0, ZMQ_POLLIN, 0 },
         { static_cast<void*>(gossipPullSock), 0, ZMQ_POLLIN, 0 },
-        { static_cast<void*>(discoveryPullSock), 0, ZMQ_POLLIN, 0 }
+        { static_cast<void*>(discoveryPullSock), 0, ZMQ_POLLIN, 0 },
+        { static_cast<void*>(replyPullSock), 0, ZMQ_POLLIN, 0 }
     };
 
-    update_known_nodes(cfg.initialPeers);
-    for (auto& [nodeId, info] : knownNodes) {
-        info.lastSeenTs = Util::now_ms();
-    }
-
     try {
         
         while (running) {
 
-            zmq::poll(items, 3, chrono::milliseconds(100));
+            zmq::poll(items, 4, chrono::milliseconds(100));
 
-            if (items[0].revents & ZMQ_POLLIN)
-                handle_client_frame();
+            client_step(items[0].revents & ZMQ_POLLIN, items[3].revents & ZMQ_POLLIN);
+            gossip_step(items[1].revents & ZMQ_POLLIN, nextStateGossipTs);
+            discovery_step(items[2].revents & ZMQ_POLLIN, nextDiscoveryGossipTs);
 
-            if (items[1].revents & ZMQ_POLLIN)
-                handle_gossip_frame();
+        }
 
-            if (items[2].revents & ZMQ_POLLIN)
-                handle_discovery_frame();
 
-            if (Util::now_ms() >= nextStateGossipTs) {
-                perform_shard_gossip();
-                nextStateGossipTs = next_gossip_ts(cfg.gossipIntervalMs);
-            }
+    } catch (const zmq::error_t& e) {
+        if (e.num() == ETERM || e.num() == EAGAIN) {
+            return;
+        }
+    }
+}
 
-            if (Util::now_ms() >= nextDiscoveryGossipTs) {
-                evict_dead_nodes();
-                perform_discovery_gossip();
-                nextDiscoveryGossipTs = next_gossip_ts(cfg.discoveryIntervalMs);
-            }
+// In split mode each subsystem polls only its own sockets, so a large
+// gossip round or a slow discovery peer never delays client replies.
+void Node::client_loop() {
+    zmq::pollitem_t items[] = {
+        { static_cast<void*>(routerSock), 0, ZMQ_POLLIN, 0 },
+        { static_cast<void*>(replyPullSock), 0, ZMQ_POLLIN, 0 }
+    };
 
+    try {
+        while (running) {
+            zmq::poll(items, 2, chrono::milliseconds(100));
+            client_step(items[0].revents & ZMQ_POLLIN, items[1].revents & ZMQ_POLLIN);
         }
+    } catch (const zmq::error_t& e) {
+        if (e.num() == ETERM || e.num() == EAGAIN) {
+            return;
+        }
+    }
+}
 
+void Node::gossip_loop() {
+    uint64_t nextStateGossipTs = next_gossip_ts(cfg.gossipIntervalMs);
+    zmq::pollitem_t items[] = {
+        { static_cast<void*>(gossipPullSock), 0, ZMQ_POLLIN, 0 }
+    };
 
+    try {
+        while (running) {
+            // Short timeout: queued fanouts and peer changes are picked up here
+            zmq::poll(items, 1, chrono::milliseconds(10));
+            gossip_step(items[0].revents & ZMQ_POLLIN, nextStateGossipTs);
+        }
     } catch (const zmq::error_t& e) {
         if (e.num() == ETERM || e.num() == EAGAIN) {
             return;
@@ -127,53 +239,207 @@ void Node::run_loop() {
     }
 }
 
+void Node::discovery_loop() {
+    uint64_t nextDiscoveryGossipTs = next_gossip_ts(cfg.discoveryIntervalMs);
+    zmq::pollitem_t items[] = {
+        { static_cast<void*>(discoveryPullSock), 0, ZMQ_POLLIN, 0 }
+    };
+
+    try {
+        while (running) {
+            zmq::poll(items, 1, chrono::milliseconds(100));
+            discovery_step(items[0].revents & ZMQ_POLLIN, nextDiscoveryGossipTs);
+        }
+    } catch (const zmq::error_t& e) {
+        if (e.num() == ETERM || e.num() == EAGAIN) {
+            return;
+        }
+    }
+}
+
+void Node::client_step(bool requestReady, bool replyReady) {
+    if (requestReady)
+        handle_client_frame();
+
+    if (replyReady)
+        forward_client_reply();
+}
+
+void Node::gossip_step(bool frameReady, uint64_t& nextStateGossipTs) {
+    apply_peer_changes();
+
+    // Handlers take stateMutex only around merges and state lookups; decoding,
+    // db scans, encoding and sends run unlocked so clients are not held up
+    if (frameReady) {
+        uint64_t start = Util::now_us();
+        handle_gossip_frame();
+        gossipLatency.record(Util::now_us() - start);
+    }
+
+    drain_pending_fanout();
+
+    {
+        TimedLock lk(stateMutex, nullptr, &gossipLockHold);
+        migrate_step();
+    }
+
+    {
+        // Close the group commit window even when no further writes arrive
+        TimedLock lk(stateMutex, nullptr, &gossipLockHold);
+        db.flush();
+        recover_rolled_back();
+    }
+
+    if (Util::now_ms() >= nextStateGossipTs) {
+        uint64_t start = Util::now_us();
+        perform_shard_gossip();
+        gossipLatency.record(Util::now_us() - start);
+        nextStateGossipTs = next_gossip_ts(cfg.gossipIntervalMs);
+    }
+}
+
+void Node::discovery_step(bool frameReady, uint64_t& nextDiscoveryGossipTs) {
+    if (frameReady) {
+        uint64_t start = Util::now_us();
+        handle_discovery_frame();
+        discoveryLatency.record(Util::now_us() - start);
+    }
+
+    if (Util::now_ms() >= nextDiscoveryGossipTs) {
+        uint64_t start = Util::now_us();
+        evict_dead_nodes();
+        perform_discovery_gossip();
+        discoveryLatency.record(Util::now_us() - start);
+        nextDiscoveryGossipTs = next_gossip_ts(cfg.discoveryIntervalMs);
+    }
+}
+
+// The ROUTER socket prefixes every request with the routing frames of its
+// sender; they are kept aside and echoed so the reply finds its way back.
 void Node::handle_client_frame() {
+    uint64_t receivedUs = Util::now_us();
+    vector<zmq::message_t> envelope;
     zmq::message_t frame;
-    repSock.recv(frame, zmq::recv_flags::none);
+    while (true) {
+        routerSock.recv(frame, zmq::recv_flags::none);
+        if (!frame.more()) break;
+        envelope.push_back(move(frame));
+        frame = zmq::message_t();
+    }
 
-    Message m = Message::from_zmq(frame);
+    // Frames from peers running another format must not take the thread down
+    Message m;
+    bool valid = true;
+    try {
+        m = Message::from_zmq(frame);
+    } catch (const exception& e) {
+        cerr << "[Node " << cfg.nodeId << "] dropping undecodable client request: " << e.what() << "\n";
+        valid = false;
+    }
+    if (!valid || (m.op != OpType::GET_NODES && m.lists.empty())) {
+        string err = "BAD_REQUEST";
+        zmq::message_t errm(err.size());
+        memcpy(errm.data(), err.data(), err.size());
+        send_client_reply(envelope, move(errm));
+        clientLatency.record(Util::now_us() - receivedUs);
+        return;
+    }
 
     if (m.op == OpType::GET_NODES) {
         vector<NodeInfo> nodes;
-        for (auto& [_, n] : knownNodes)
-            nodes.push_back(n);   
+        {
+            lock_guard<mutex> lk(nodesMutex);
+            // Replicas of a shard still being filled are not routable yet
+            for (auto& [_, n] : knownNodes) {
+                if (n.shardWeight > 0)
+                    nodes.push_back(n);
+            }
+        }
         Message resp = Message::nodes_response(
             cfg.nodeId,
             Util::now_ms(),
             nodes
         );
 
-        repSock.send(resp.to_zmq(), zmq::send_flags::none);
+        send_client_reply(envelope, resp.to_zmq());
+        clientLatency.record(Util::now_us() - receivedUs);
         return;
     }
 
-    int s = shard_for_list(m.lists[0].getUid());
-    if (s != cfg.shardId) {
+    // Every list of a batch must belong here, not just the one it is routed by
+    bool owned = all_of(m.lists.begin(), m.lists.end(),
+                        [&](const ShoppingList& list) { return owns_list(list.getUid()); });
+    if (!owned) {
         string err = "WRONG_SHARD";
         zmq::message_t errm(err.size());
         memcpy(errm.data(), err.data(), err.size());
-        repSock.send(errm, zmq::send_flags::none);
+        send_client_reply(envelope, move(errm));
+        clientLatency.record(Util::now_us() - receivedUs);
         return;
     }
 
+    if (workers.empty()) {
+        send_client_reply(envelope, serve_client_request(move(m)));
+        clientLatency.record(Util::now_us() - receivedUs);
+        return;
+    }
+
+    ClientWorker& w = *workers[Util::wyhash64(m.lists[0].getUid()) % workers.size()];
+    {
+        lock_guard<mutex> lk(w.mtx);
+        w.jobs.push_back(ClientJob{move(envelope), move(m), receivedUs});
+    }
+    w.cv.notify_one();
+}
+
+void Node::send_client_reply(vector<zmq::message_t>& envelope, zmq::message_t payload) {
+    for (auto& part : envelope)
+        routerSock.send(part, zmq::send_flags::sndmore);
+    routerSock.send(payload, zmq::send_flags::none);
+}
+
+// Workers cannot touch the ROUTER socket, so their replies come back over
+// inproc with the envelope in front and are relayed here unchanged
+void Node::forward_client_reply() {
+    zmq::message_t frame;
+    do {
+        replyPullSock.recv(frame, zmq::recv_flags::none);
+        routerSock.send(frame, frame.more() ? zmq::send_flags::sndmore : zmq::send_flags::none);
+    } while (frame.more());
+}
+
+// Decoding and encoding run outside the state lock; only the merge with the
+// stored list holds it
+zmq::message_t Node::serve_client_request(Message m) {
     if (m.op == OpType::GET_LIST) {
-        optional<ShoppingList> opt;
         string listUid = m.lists[0].getUid();
-        opt = db.read(listUid);
+        optional<ShoppingList> opt;
+        {
+            TimedLock lk(stateMutex, &clientLockWait, nullptr);
+            opt = load_list(listUid);
+        }
 
         Message resp = opt.has_value() ?
             Message::list_response(true, cfg.nodeId, Util::now_ms(), *opt) :
             Message::list_response(false, cfg.nodeId, Util::now_ms(), ShoppingList(listUid, ""));
-        zmq::message_t out = resp.to_zmq();
-        repSock.send(out, zmq::send_flags::none);
-        return;
+        return resp.to_zmq();
     }
 
     m.origin = cfg.nodeId;
     m.ts = Util::now_ms();
 
-    apply_message(m);
-    eager_fanout();
+    optional<ShoppingList> merged;
+    {
+        TimedLock lk(stateMutex, &clientLockWait, nullptr);
+        if (m.op == OpType::ENSURE_LIST)
+            merged = ensure_list(m.lists[0]);
+        else
+            apply_message(m);
+    }
+    // A full queue only skips the eager push; the write is in the change
+    // feed and goes out with the next delta round anyway
+    if (merged.has_value())
+        fanoutQueue.try_push(move(*merged));
 
     Message resp = Message::list_response(
         m.op == OpType::DELETE_LIST ? false : true,
@@ -181,38 +447,88 @@ void Node::handle_client_frame() {
         Util::now_ms(),
         m.lists[0]
     );
+    return resp.to_zmq();
+}
+
+void Node::worker_loop(size_t index) {
+    ClientWorker& w = *workers[index];
+    try {
+        zmq::socket_t replySock(ctx, ZMQ_PUSH);
+        replySock.connect("inproc://client-replies");
+
+        while (running) {
+            ClientJob job;
+            {
+                unique_lock<mutex> lk(w.mtx);
+                w.cv.wait(lk, [&] { return !w.jobs.empty() || !running; });
+                if (!running) break;
+                job = move(w.jobs.front());
+                w.jobs.pop_front();
+            }
+
+            zmq::message_t out = serve_client_request(move(job.request));
+            for (auto& part : job.envelope)
+                replySock.send(part, zmq::send_flags::sndmore);
+            replySock.send(out, zmq::send_flags::none);
+            clientLatency.record(Util::now_us() - job.receivedUs);
+        }
+        replySock.close();
+    } catch (const zmq::error_t& e) {
+        if (e.num() != ETERM) {
+            cerr << "[Node " << cfg.nodeId << "] client worker " << index << " failed: " << e.what() << "\n";
+        }
+    }
+}
 
-    repSock.send(resp.to_zmq(), zmq::send_flags::none);
+void Node::drain_pending_fanout() {
+    for (auto list = fanoutQueue.try_pop(); list.has_value(); list = fanoutQueue.try_pop())
+        eager_fanout(*list);
 }
 
 void Node::handle_gossip_frame() {
     zmq::message_t gf;
     gossipPullSock.recv(gf, zmq::recv_flags::none);
-    Message gm = Message::from_zmq(gf);
+    Message gm;
+    try {
+        gm = Message::from_zmq(gf);
+    } catch (const exception& e) {
+        cerr << "[Node " << cfg.nodeId << "] dropping undecodable gossip frame: " << e.what() << "\n";
+        return;
+    }
+
+    vector<Message> replies;
+    {
+        TimedLock lk(stateMutex, nullptr, &gossipLockHold);
+        if (gm.op == OpType::GOSSIP_LISTS)
+            apply_message(gm);
+        else if (gm.op == OpType::DIGEST_NODES)
+            handle_digest_nodes(gm, replies);
+        else if (gm.op == OpType::DIGEST_LEAVES)
+            handle_digest_leaves(gm, replies);
+        else if (gm.op == OpType::MIGRATE_LISTS)
+            handle_migrate_lists(gm, replies);
+        else if (gm.op == OpType::MIGRATE_ACK)
+            handle_migrate_ack(gm);
+    }
 
-    if (gm.op == OpType::GOSSIP_LISTS)
-        apply_message(gm);
+    for (auto& reply : replies)
+        send_to_node(gm.origin, reply);
 }
 
 void Node::apply_message(const Message& m) {
     switch (m.op) {
         case OpType::ENSURE_LIST: {
-            ShoppingList incomingList = m.lists[0];
-            ShoppingList existingList = db.read(incomingList.getUid()).value_or(ShoppingList(incomingList.getUid(), ""));
-            existingList.merge(incomingList);
-            db.write(existingList);
+            ensure_list(m.lists[0]);
             break;
         }
         case OpType::DELETE_LIST: {
+            cache.erase(m.lists[0].getUid());
             db.delete_list(m.lists[0].getUid());
+            fannedOut.erase(m.lists[0].getUid());
             break;
         }
         case OpType::GOSSIP_LISTS: {
-            for (auto& incomingList : m.lists) {
-                ShoppingList existingList = db.read(incomingList.getUid()).value_or(ShoppingList(incomingList.getUid(), ""));
-                existingList.merge(incomingList);
-                db.write(existingList);
-            }
+            merge_lists(m.lists);
             break;
         }
         default:
@@ -220,22 +536,258 @@ void Node::apply_message(const Message& m) {
     }
 }
 
-void Node::eager_fanout() {
-    for (int i = 0; i < 3; i++)
-        perform_shard_gossip();
+// Lists are served from the cache when hot; misses are read from the db and
+// kept. Returned lists are copies, so callers merge without touching the cache.
+optional<ShoppingList> Node::load_list(const string& listId) {
+    if (ShoppingList* cached = cache.get(listId))
+        return *cached;
+
+    optional<ShoppingList> stored = db.read(listId);
+    if (stored.has_value())
+        store_evicted(cache.put(*stored, false));
+    return stored;
+}
+
+vector<optional<ShoppingList>> Node::load_lists(const vector<string>& ids) {
+    vector<optional<ShoppingList>> lists(ids.size());
+    vector<string> missing;
+    vector<size_t> missingSlots;
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (ShoppingList* cached = cache.get(ids[i])) {
+            lists[i] = *cached;
+        } else {
+            missing.push_back(ids[i]);
+            missingSlots.push_back(i);
+        }
+    }
+    if (missing.empty()) return lists;
+
+    vector<optional<ShoppingList>> stored = db.read_many(missing);
+    for (size_t i = 0; i < missing.size(); i++) {
+        if (!stored[i].has_value()) continue;
+        store_evicted(cache.put(*stored[i], false));
+        lists[missingSlots[i]] = move(stored[i]);
+    }
+    return lists;
+}
+
+// Changed lists stay in memory until the next flush; only lists pushed out of
+// the cache by the byte budget are written right away
+void Node::store_list(const ShoppingList& list) {
+    store_evicted(cache.put(list, true));
+}
+
+void Node::store_evicted(const vector<ShoppingList>& evicted) {
+    if (!evicted.empty() && !db.write_many(evicted))
+        cerr << "[Node " << cfg.nodeId << "] failed to write back evicted lists\n";
+}
+
+// Lists count as clean once handed to the db; with group commit that is
+// before the COMMIT, so lists of a commit that failed are taken back first
+void Node::flush_cache() {
+    recover_rolled_back();
+    vector<ShoppingList> dirty = cache.take_dirty();
+    if (dirty.empty()) return;
+    if (!db.write_many(dirty)) {
+        cerr << "[Node " << cfg.nodeId << "] failed to write back cached lists\n";
+        cache.mark_dirty(dirty);
+    }
+}
+
+void Node::recover_rolled_back() {
+    vector<ShoppingList> lost = db.take_rolled_back();
+    if (lost.empty()) return;
+    cerr << "[Node " << cfg.nodeId << "] group commit failed, keeping " << lost.size() << " lists dirty\n";
+    store_evicted(cache.restore(lost));
+}
+
+ShoppingList Node::ensure_list(const ShoppingList& incomingList) {
+    optional<ShoppingList> stored = load_list(incomingList.getUid());
+    ShoppingList existingList = stored.value_or(ShoppingList(incomingList.getUid(), ""));
+    if (existingList.merge(incomingList) || !stored.has_value()) {
+        mark_changed(existingList.getUid());
+        store_list(existingList);
+    }
+    return existingList;
+}
+
+// Reads every list of the batch in one query, merges in memory and writes the
+// ones that changed in a single transaction instead of one commit per list.
+// Lists this shard does not own under the current ring are dropped: after a
+// cutover, replicas still on the old ring keep sending the moved lists.
+void Node::merge_lists(const vector<ShoppingList>& lists) {
+    if (lists.empty()) return;
+
+    vector<string> ids;
+    unordered_map<string, size_t> slots;
+    for (auto& incomingList : lists) {
+        const string& uid = incomingList.getUid();
+        if (slots.count(uid) || !owns_list(uid)) continue;
+        slots.emplace(uid, ids.size());
+        ids.push_back(uid);
+    }
+    if (ids.empty()) return;
+
+    vector<optional<ShoppingList>> stored = load_lists(ids);
+    vector<ShoppingList> merged;
+    vector<bool> changed(ids.size(), false);
+    merged.reserve(ids.size());
+    for (size_t i = 0; i < ids.size(); i++) {
+        changed[i] = !stored[i].has_value();
+        merged.push_back(stored[i].has_value() ? move(*stored[i]) : ShoppingList(ids[i], ""));
+    }
+
+    for (auto& incomingList : lists) {
+        auto slot = slots.find(incomingList.getUid());
+        if (slot == slots.end()) continue;
+        if (merged[slot->second].merge(incomingList))
+            changed[slot->second] = true;
+    }
+
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (!changed[i]) continue;
+        mark_changed(ids[i]);
+        store_list(merged[i]);
+    }
+}
+
+void Node::mark_changed(const string& listId) {
+    if (migration.active && migration.nextRing.shard_for(listId) == migration.targetShard) {
+        migration.pending.insert(listId);
+        migration.confirmed.erase(listId);
+    }
+}
+
+// Pushes just the freshly merged list to a few replicas so the write path
+// costs O(list size); the regular rounds take it to the rest of the shard.
+void Node::eager_fanout(const ShoppingList& list) {
+    if (cfg.eagerFanout <= 0 || connectedShard.empty()) return;
+
+    size_t k = min<size_t>(cfg.eagerFanout, connectedShard.size());
+    if (k == connectedShard.size()) {
+        TimedLock lk(stateMutex, nullptr, &gossipLockHold);
+        fannedOut[list.getUid()] = list.digest();
+    }
+
+    push_shard_message(Message::gossip_lists(cfg.nodeId, Util::now_ms(), {list}), k);
 }
 
 void Node::perform_shard_gossip() {
-    vector<ShoppingList> lists = db.read_all();
+    bool fullSync = !cfg.deltaGossip ||
+        cfg.fullSyncEveryRounds <= 0 ||
+        gossipRound % cfg.fullSyncEveryRounds == 0;
+    gossipRound++;
 
-    Message m = Message::gossip_lists(
-        cfg.nodeId,
-        Util::now_ms(),
-        lists
-    );
+    {
+        TimedLock lk(stateMutex, nullptr, &gossipLockHold);
+        // Digests and full state are taken from the db, so it has to be current
+        flush_cache();
+    }
+
+    if (!fullSync)
+        gossip_changes();
+    else if (cfg.digestSync)
+        start_digest_exchange();
+    else
+        gossip_full_state();
+}
+
+void Node::gossip_full_state() {
+    // Everything we have supersedes whatever was pending as a delta
+    gossipCursor = db.last_seq();
+    {
+        TimedLock lk(stateMutex, nullptr, &gossipLockHold);
+        fannedOut.clear();
+    }
+
+    // Streamed page by page so neither the lists nor the frame grow with the
+    // db; the db is only locked while a page is read, so client misses and
+    // write-backs interleave with a large round
+    size_t chunk = max(cfg.gossipChunkLists, 1);
+    string after;
+    while (true) {
+        vector<ShoppingList> page = db.read_page(after, chunk);
+        if (page.empty()) break;
+        after = page.back().getUid();
+        push_shard_message(Message::gossip_lists(cfg.nodeId, Util::now_ms(), page));
+        if (page.size() < chunk) break;
+    }
+}
+
+// Ships whatever the db change feed holds past the cursor, chunk by chunk.
+// Lists an eager fanout already put on every replica are skipped unless
+// they changed again since.
+void Node::gossip_changes() {
+    unordered_map<string, uint64_t> fanned;
+    {
+        TimedLock lk(stateMutex, nullptr, &gossipLockHold);
+        fanned.swap(fannedOut);
+    }
+
+    size_t chunk = max(cfg.gossipChunkLists, 1);
+    while (true) {
+        vector<ChangedList> changes = db.read_changed_since(gossipCursor, chunk);
+        if (changes.empty()) break;
+        gossipCursor = changes.back().seq;
+
+        vector<ShoppingList> lists;
+        for (auto& c : changes) {
+            auto it = fanned.find(c.list.getUid());
+            if (it != fanned.end() && it->second == c.list.digest()) continue;
+            lists.push_back(move(c.list));
+        }
+
+        // PUSH round-robins between connected replicas, so one copy per
+        // replica hands the delta to every peer of the shard
+        if (!lists.empty()) {
+            push_shard_message(
+                Message::gossip_lists(cfg.nodeId, Util::now_ms(), lists),
+                max<size_t>(connectedShard.size(), 1)
+            );
+        }
+        if (changes.size() < chunk) break;
+    }
+}
+
+// Packed once; every copy is a zmq_msg_copy of the frame, which shares the
+// packed bytes by reference count instead of packing or copying them again
+void Node::push_shard_message(const Message& m, size_t copies) {
+    if (copies == 0) return;
+    zmq::message_t frame = m.to_zmq();
+    try {
+        for (size_t i = 1; i < copies; i++) {
+            zmq::message_t copy;
+            copy.copy(frame);
+            gossipPushSock.send(copy, zmq::send_flags::dontwait);
+        }
+        gossipPushSock.send(frame, zmq::send_flags::dontwait);
+    } catch (const zmq::error_t& e) {
+        if (e.num() != EAGAIN) {
+            return;
+        }
+    }
+}
+
+// Sends to one node through its own socket, connected on first use. The
+// endpoint comes from discovery; unknown nodes are skipped.
+void Node::send_to_node(const string& nodeId, const Message& m) {
+    auto it = nodeSocks.find(nodeId);
+    if (it == nodeSocks.end()) {
+        string ep;
+        {
+            lock_guard<mutex> lk(nodesMutex);
+            auto n = knownNodes.find(nodeId);
+            if (n == knownNodes.end()) return;
+            ep = "tcp://" + n->second.host + ":" + to_string(n->second.gossipPullPort);
+        }
+        zmq::socket_t sock(ctx, ZMQ_PUSH);
+        sock.set(zmq::sockopt::linger, 0);
+        sock.connect(ep);
+        it = nodeSocks.emplace(nodeId, move(sock)).first;
+    }
 
     try {
-        gossipPushSock.send(m.to_zmq(), zmq::send_flags::dontwait);
+        it->second.send(m.to_zmq(), zmq::send_flags::dontwait);
     } catch (const zmq::error_t& e) {
         if (e.num() != EAGAIN) {
             return;
@@ -243,11 +795,117 @@ void Node::perform_shard_gossip() {
     }
 }
 
+// Every replica gets the root; each step of the descent is answered to the
+// replica that sent it, so one pair keeps narrowing down its own mismatch.
+void Node::start_digest_exchange() {
+    vector<DigestEntry> root;
+    {
+        TimedLock lk(stateMutex, nullptr, &gossipLockHold);
+        root = {{MerkleTree::ROOT, db.merkle().root(), ""}};
+    }
+    Message m = Message::digest_nodes(cfg.nodeId, Util::now_ms(), root);
+    for (auto& peer : connectedShard)
+        send_to_node(peer, m);
+}
+
+// Digest handlers run under stateMutex and only queue their replies, which
+// are encoded and sent after the lock is released
+void Node::handle_digest_nodes(const Message& m, vector<Message>& replies) {
+    flush_cache();
+    const MerkleTree& tree = db.merkle();
+    vector<DigestEntry> children;
+    vector<uint32_t> leaves;
+
+    for (auto& d : m.digests) {
+        if (!MerkleTree::valid(d.node) || tree.node(d.node) == d.hash)
+            continue;
+
+        if (MerkleTree::is_leaf(d.node)) {
+            leaves.push_back(d.node);
+            continue;
+        }
+
+        for (uint32_t c : {2 * d.node, 2 * d.node + 1})
+            children.push_back({c, tree.node(c), ""});
+    }
+
+    if (!children.empty())
+        replies.push_back(Message::digest_nodes(cfg.nodeId, Util::now_ms(), children));
+
+    if (!leaves.empty())
+        replies.push_back(Message::digest_leaves(cfg.nodeId, Util::now_ms(), leaf_digests(leaves), {}));
+}
+
+void Node::handle_digest_leaves(const Message& m, vector<Message>& replies) {
+    // Lists the sender already knew we disagree on are merged before comparing
+    merge_lists(m.lists);
+    flush_cache();
+
+    unordered_map<uint32_t, unordered_map<string, uint64_t>> theirs;
+    for (auto& d : m.digests) {
+        if (!MerkleTree::is_leaf(d.node)) continue;
+        auto& bucket = theirs[d.node];
+        if (!d.listId.empty()) bucket[d.listId] = d.hash;
+    }
+
+    const MerkleTree& tree = db.merkle();
+    vector<string> newerHere;
+    vector<uint32_t> divergentLeaves;
+
+    for (auto& [leaf, bucket] : theirs) {
+        const auto& mine = tree.leaf_entries(leaf);
+        bool divergent = false;
+
+        for (auto& [id, hash] : mine) {
+            auto it = bucket.find(id);
+            if (it == bucket.end() || it->second != hash) {
+                newerHere.push_back(id);
+                divergent = true;
+            }
+        }
+        for (auto& [id, hash] : bucket) {
+            auto it = mine.find(id);
+            if (it == mine.end())
+                divergent = true;
+        }
+
+        if (divergent) divergentLeaves.push_back(leaf);
+    }
+
+    if (divergentLeaves.empty()) return;
+
+    // Our leaf listing lets the receiver send back whatever we are missing
+    vector<ShoppingList> lists;
+    for (auto& opt : load_lists(newerHere)) {
+        if (opt.has_value())
+            lists.push_back(move(*opt));
+    }
+    replies.push_back(Message::digest_leaves(cfg.nodeId, Util::now_ms(), leaf_digests(divergentLeaves), move(lists)));
+}
+
+vector<DigestEntry> Node::leaf_digests(const vector<uint32_t>& leaves) const {
+    const MerkleTree& tree = db.merkle();
+    vector<DigestEntry> entries;
+    for (uint32_t leaf : leaves) {
+        const auto& bucket = tree.leaf_entries(leaf);
+        if (bucket.empty()) {
+            entries.push_back({leaf, 0, ""});
+            continue;
+        }
+        for (auto& [id, hash] : bucket)
+            entries.push_back({leaf, hash, id});
+    }
+    return entries;
+}
+
 void Node::perform_discovery_gossip() {
-    knownNodes[cfg.nodeId].lastSeenTs = Util::now_ms();
     vector<NodeInfo> nodes;
-    for (auto& [_, n] : knownNodes)
-        nodes.push_back(n);
+    {
+        lock_guard<mutex> lk(nodesMutex);
+        knownNodes[cfg.nodeId].lastSeenTs = Util::now_ms();
+        for (auto& [_, n] : knownNodes)
+            nodes.push_back(n);
+    }
 
     Message m = Message::gossip_nodes(
         cfg.nodeId,
@@ -267,7 +925,13 @@ void Node::perform_discovery_gossip() {
 void Node::handle_discovery_frame() {
     zmq::message_t gf;
     discoveryPullSock.recv(gf, zmq::recv_flags::none);
-    Message gm = Message::from_zmq(gf);
+    Message gm;
+    try {
+        gm = Message::from_zmq(gf);
+    } catch (const exception& e) {
+        cerr << "[Node " << cfg.nodeId << "] dropping undecodable discovery frame: " << e.what() << "\n";
+        return;
+    }
 
     if (gm.op != OpType::GOSSIP_NODES)
         return;
@@ -275,78 +939,346 @@ void Node::handle_discovery_frame() {
     update_known_nodes(gm.nodes);
 }
 
+// Peer changes are queued after nodesMutex is released: queueing may wait
+// for the gossip thread, which takes nodesMutex itself
 void Node::update_known_nodes(const std::vector<message::NodeInfo>& nodes) {
-    for (auto& n : nodes) {
+    vector<PeerChange> changes;
+    {
+        lock_guard<mutex> lk(nodesMutex);
+        for (auto& n : nodes) {
+
+            if (n.nodeId == cfg.nodeId)
+                continue;
+
+            auto it = knownNodes.find(n.nodeId);
+            bool isNew = (it == knownNodes.end());
+
+            if (!isNew && it->second.lastSeenTs > n.lastSeenTs)
+                continue;
+
+            if (isNew) {
+                knownNodes[n.nodeId] = n;
+
+                if (connectedDiscovery.insert(n.nodeId).second) {
+                    std::string ep =
+                        "tcp://" + n.host + ":" + std::to_string(n.discoveryPullPort);
+                    discoveryPushSock.connect(ep);
+                }
+
+                if (n.shardId == cfg.shardId) {
+                    std::string ep =
+                        "tcp://" + n.host + ":" + std::to_string(n.gossipPullPort);
+                    changes.push_back(PeerChange{true, n.nodeId, ep});
+                }
+            } else {
+                it->second = n;
+            }
 
-        if (n.nodeId == cfg.nodeId)
-            continue;
+            // Only update lastSeenTs to the gossiped value, not to now
+            knownNodes[n.nodeId].lastSeenTs = n.lastSeenTs;
+        }
+    }
 
-        auto it = knownNodes.find(n.nodeId);
-        bool isNew = (it == knownNodes.end());
+    for (auto& c : changes)
+        queue_peer_change(c.connect, c.nodeId, c.endpoint);
+}
 
-        if (!isNew && it->second.lastSeenTs > n.lastSeenTs)
-            continue;
+uint64_t Node::next_gossip_ts(uint64_t interval) const {
+    int i = static_cast<int>(interval);
+    int jitter = Util::rand_int(-i / 3, i / 3);
+    return Util::now_ms() + interval + jitter;
+}
+
+void Node::evict_dead_nodes() {
+    uint64_t now = Util::now_ms();
+    vector<PeerChange> changes;
+    {
+        lock_guard<mutex> lk(nodesMutex);
 
-        if (isNew) {
-            knownNodes[n.nodeId] = n;
+        for (auto it = knownNodes.begin(); it != knownNodes.end(); ) {
+            const auto& nodeId = it->first;
+            const auto& info = it->second;
 
-            if (connectedDiscovery.insert(n.nodeId).second) {
+            if (nodeId == cfg.nodeId) {
+                ++it;
+                continue;
+            }
+
+            if (now - info.lastSeenTs <= cfg.discoveryTimeoutMs) {
+                ++it;
+                continue;
+            }
+
+            if (connectedDiscovery.erase(nodeId)) {
                 std::string ep =
-                    "tcp://" + n.host + ":" + std::to_string(n.discoveryPullPort);
-                discoveryPushSock.connect(ep);
+                    "tcp://" + info.host + ":" + std::to_string(info.discoveryPullPort);
+                discoveryPushSock.disconnect(ep);
             }
 
-            if (n.shardId == cfg.shardId &&
-                connectedShard.insert(n.nodeId).second) {
+            if (info.shardId == cfg.shardId) {
                 std::string ep =
-                    "tcp://" + n.host + ":" + std::to_string(n.gossipPullPort);
-                gossipPushSock.connect(ep);
+                    "tcp://" + info.host + ":" + std::to_string(info.gossipPullPort);
+                changes.push_back(PeerChange{false, nodeId, ep});
             }
-        } else {
-            it->second = n;
+
+            it = knownNodes.erase(it);
         }
+    }
 
-        // Only update lastSeenTs to the gossiped value, not to now
-        knownNodes[n.nodeId].lastSeenTs = n.lastSeenTs;
+    for (auto& c : changes)
+        queue_peer_change(c.connect, c.nodeId, c.endpoint);
+}
+
+// Called by discovery without nodesMutex held; the gossip socket is only
+// ever touched by its owner
+void Node::queue_peer_change(bool connect, const string& nodeId, const string& endpoint) {
+    while (!peerChanges.try_push(PeerChange{connect, nodeId, endpoint})) {
+        if (!running) return;
+        // With a single loop the caller is the owner and has to drain itself
+        if (cfg.threading == ThreadingMode::SINGLE) apply_peer_changes();
+        else this_thread::yield();
     }
 }
 
-uint64_t Node::next_gossip_ts(uint64_t interval) const {
-    int i = static_cast<int>(interval);
-    int jitter = Util::rand_int(-i / 3, i / 3);
-    return Util::now_ms() + interval + jitter;
+void Node::apply_peer_changes() {
+    for (auto c = peerChanges.try_pop(); c.has_value(); c = peerChanges.try_pop()) {
+        if (c->connect) {
+            if (connectedShard.insert(c->nodeId).second)
+                gossipPushSock.connect(c->endpoint);
+        } else {
+            if (connectedShard.erase(c->nodeId))
+                gossipPushSock.disconnect(c->endpoint);
+            // A node that comes back may listen on a different endpoint
+            auto sock = nodeSocks.find(c->nodeId);
+            if (sock != nodeSocks.end()) {
+                sock->second.close();
+                nodeSocks.erase(sock);
+            }
+        }
+    }
 }
 
-void Node::evict_dead_nodes() {
-    uint64_t now = Util::now_ms();
+bool Node::begin_migration(int newShardId, uint32_t weight) {
+    vector<string> endpoints;
+    {
+        lock_guard<mutex> lk(nodesMutex);
+        for (auto& [nodeId, info] : knownNodes) {
+            if (info.shardId == newShardId)
+                endpoints.push_back("tcp://" + info.host + ":" + to_string(info.gossipPullPort));
+        }
+    }
+    if (endpoints.empty()) return false;
 
-    for (auto it = knownNodes.begin(); it != knownNodes.end(); ) {
-        const auto& nodeId = it->first;
-        const auto& info = it->second;
+    lock_guard<mutex> lk(stateMutex);
+    if (migration.active) return false;
 
-        if (nodeId == cfg.nodeId) {
-            ++it;
-            continue;
-        }
+    {
+        shared_lock<shared_mutex> rlk(ringMutex);
+        if (ring.shards().count(newShardId)) return false;
+        migration.nextRing = ring;
+    }
+    // The scan walks the Merkle tree, which only covers what reached the db;
+    // dirty cached lists would otherwise be neither scanned nor pending
+    flush_cache();
+
+    migration.nextRing.set_shard(newShardId, weight);
+    migration.targetShard = newShardId;
+    migration.nextLeaf = MerkleTree::LEAVES;
+    migration.pending.clear();
+    migration.awaiting.clear();
+    migration.confirmed.clear();
+    migration.endpoints = move(endpoints);
+    migration.startedMs = Util::now_ms();
+    migration.listsSent = 0;
+    migration.bytesSent = 0;
+    migration.active = true;
+    return true;
+}
 
-        if (now - info.lastSeenTs <= cfg.discoveryTimeoutMs) {
+MigrationStatus Node::migration_status() {
+    lock_guard<mutex> lk(stateMutex);
+    MigrationStatus st;
+    st.active = migration.active;
+    st.targetShard = migration.targetShard;
+    if (!migration.active) return st;
+
+    st.scanned = double(migration.nextLeaf - MerkleTree::LEAVES) / MerkleTree::LEAVES;
+    st.listsSent = migration.listsSent;
+    st.bytesSent = migration.bytesSent;
+    st.pendingLists = migration.pending.size();
+    st.unackedLists = migration.awaiting.size();
+    uint64_t elapsedMs = Util::now_ms() - migration.startedMs;
+    st.listsPerSec = elapsedMs == 0 ? 0 : migration.listsSent * 1000.0 / elapsedMs;
+    st.complete = migration.nextLeaf == 2 * MerkleTree::LEAVES &&
+        migration.pending.empty() && migration.awaiting.empty();
+    return st;
+}
+
+// Walks the Merkle leaves as a cursor so every stored list is visited once;
+// lists written meanwhile are caught by mark_changed and resent. One copy per
+// batch is enough: the new shard's own gossip spreads it to its replicas.
+// A list only counts as handed over once the receiver acks it; batches
+// without an ack in time are resent.
+void Node::migrate_step() {
+    if (!migration.active) return;
+
+    if (migrationConnected != migration.endpoints) {
+        for (auto& ep : migrationConnected) migrationPushSock.disconnect(ep);
+        for (auto& ep : migration.endpoints) migrationPushSock.connect(ep);
+        migrationConnected = migration.endpoints;
+    }
+
+    uint64_t now = Util::now_ms();
+    for (auto it = migration.awaiting.begin(); it != migration.awaiting.end(); ) {
+        if (now - it->second.sentMs < static_cast<uint64_t>(cfg.migrationAckTimeoutMs)) {
             ++it;
             continue;
         }
+        migration.pending.insert(it->first);
+        it = migration.awaiting.erase(it);
+    }
 
-        if (connectedDiscovery.erase(nodeId)) {
-            std::string ep =
-                "tcp://" + info.host + ":" + std::to_string(info.discoveryPullPort);
-            discoveryPushSock.disconnect(ep);
+    // Keep a few batches in flight at most, so a slow receiver is not flooded
+    size_t batch = max(cfg.migrationBatchLists, 1);
+    if (migration.awaiting.size() >= 4 * batch) return;
+
+    vector<string> ids;
+    for (auto it = migration.pending.begin(); it != migration.pending.end() && ids.size() < batch; ) {
+        ids.push_back(*it);
+        it = migration.pending.erase(it);
+    }
+
+    const MerkleTree& tree = db.merkle();
+    while (ids.size() < batch && migration.nextLeaf < 2 * MerkleTree::LEAVES) {
+        for (auto& [id, hash] : tree.leaf_entries(migration.nextLeaf)) {
+            if (migration.nextRing.shard_for(id) == migration.targetShard)
+                ids.push_back(id);
         }
+        migration.nextLeaf++;
+    }
+    if (ids.empty()) return;
+
+    vector<ShoppingList> lists;
+    for (auto& opt : load_lists(ids)) {
+        if (opt.has_value())
+            lists.push_back(move(*opt));
+    }
+    if (lists.empty()) return;
+
+    zmq::message_t out = Message::migrate_lists(cfg.nodeId, now, lists).to_zmq();
+    size_t bytes = out.size();
+    bool sent = false;
+    try {
+        sent = migrationPushSock.send(out, zmq::send_flags::dontwait).has_value();
+    } catch (const zmq::error_t& e) {
+        if (e.num() != EAGAIN) throw;
+    }
 
-        if (info.shardId == cfg.shardId && connectedShard.erase(nodeId)) {
-            std::string ep =
-                "tcp://" + info.host + ":" + std::to_string(info.gossipPullPort);
-            gossipPushSock.disconnect(ep);
+    if (!sent) {
+        // New shard is not keeping up; retry these with the next tick
+        migration.pending.insert(ids.begin(), ids.end());
+        return;
+    }
+    for (auto& list : lists)
+        migration.awaiting[list.getUid()] = {list.digest(), now};
+    migration.listsSent += lists.size();
+    migration.bytesSent += bytes;
+}
+
+// Receiving side of a handoff: the batch is merged and made durable before
+// it is acked, so the sender may drop whatever the ack covers
+void Node::handle_migrate_lists(const Message& m, vector<Message>& replies) {
+    merge_lists(m.lists);
+    flush_cache();
+    if (!db.flush(true)) {
+        cerr << "[Node " << cfg.nodeId << "] could not persist migrated lists from " << m.origin << "\n";
+        return;
+    }
+
+    // Unowned lists were not merged; acking them would let the sender drop them
+    vector<DigestEntry> acked;
+    for (auto& list : m.lists) {
+        if (owns_list(list.getUid()))
+            acked.push_back({0, list.digest(), list.getUid()});
+    }
+    replies.push_back(Message::migrate_ack(cfg.nodeId, Util::now_ms(), acked));
+}
+
+void Node::handle_migrate_ack(const Message& m) {
+    if (!migration.active) return;
+
+    for (auto& d : m.digests) {
+        auto it = migration.awaiting.find(d.listId);
+        // An ack for an older send of a list resent since does not count
+        if (it == migration.awaiting.end() || it->second.digest != d.hash) continue;
+        migration.confirmed[d.listId] = d.hash;
+        migration.awaiting.erase(it);
+    }
+}
+
+bool Node::finish_migration() {
+    lock_guard<mutex> lk(stateMutex);
+    // A cutover whose delete failed is retried without touching the ring again
+    if (!migration.active && !migration.dropping.empty()) {
+        if (!db.delete_many(migration.dropping)) return false;
+        migration.dropping.clear();
+        return true;
+    }
+    if (!migration.active ||
+        migration.nextLeaf != 2 * MerkleTree::LEAVES ||
+        !migration.pending.empty() ||
+        !migration.awaiting.empty())
+        return false;
+
+    // Only lists the new shard confirmed in their current state may be
+    // dropped; anything else is resent and the cutover has to be retried
+    flush_cache();
+    vector<string> moved;
+    bool unconfirmed = false;
+    const MerkleTree& tree = db.merkle();
+    for (uint32_t leaf = MerkleTree::LEAVES; leaf < 2 * MerkleTree::LEAVES; leaf++) {
+        for (auto& [id, hash] : tree.leaf_entries(leaf)) {
+            if (migration.nextRing.shard_for(id) != migration.targetShard) continue;
+            auto it = migration.confirmed.find(id);
+            if (it == migration.confirmed.end() || it->second != hash) {
+                migration.pending.insert(id);
+                unconfirmed = true;
+                continue;
+            }
+            moved.push_back(id);
         }
+    }
+    if (unconfirmed) return false;
 
-        it = knownNodes.erase(it);
+    {
+        unique_lock<shared_mutex> rlk(ringMutex);
+        ring = migration.nextRing;
+    }
+    migration.active = false;
+    migration.confirmed.clear();
+
+    // Everything the new shard owns was handed over; clients routed by the
+    // old ring now get WRONG_SHARD and refresh their view
+    for (auto& id : moved) {
+        cache.erase(id);
+        fannedOut.erase(id);
     }
+    if (moved.empty() || db.delete_many(moved)) return true;
+    migration.dropping = move(moved);
+    return false;
 }
 
+// Called on the new shard's replicas at cutover, once every old node
+// switched rings; from then on clients learn the shard and route to it
+void Node::complete_join() {
+    uint32_t weight = 1;
+    {
+        shared_lock<shared_mutex> rlk(ringMutex);
+        auto ownWeight = ring.shards().find(cfg.shardId);
+        if (ownWeight != ring.shards().end()) weight = ownWeight->second;
+    }
+    lock_guard<mutex> lk(nodesMutex);
+    NodeInfo& self = knownNodes[cfg.nodeId];
+    self.shardWeight = weight;
+    self.lastSeenTs = Util::now_ms();
+}
@@ -7,11 +7,27 @@
 #include <unordered_set>
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <map>
+#include <shared_mutex>
+#include <optional>
 #include <zmq.hpp>
 #include "../persistence/sqlite_db.hpp"
 #include "../message/message.hpp"
 #include "../model/shopping_list.hpp"
 #include "../model/shopping_item.hpp"
+#include "list_cache.hpp"
+#include "bounded_queue.hpp"
+#include "../metrics/latency_histogram.hpp"
+#include "../sharding/hash_ring.hpp"
+
+enum class ThreadingMode {
+    SINGLE, // one loop polls client, gossip and discovery sockets
+    SPLIT   // client, gossip and discovery each get their own thread
+};
 
 struct NodeConfig {
     std::string nodeId;
@@ -25,9 +41,36 @@ struct NodeConfig {
     std::string dbPath;
     int shardId;
     int numShards;
+    std::map<int, uint32_t> shardWeights; // ring weight per shard, 1 if absent
+    HashVersion placementHash = HashVersion::WYHASH; // must match across the cluster
     int gossipIntervalMs;
     int discoveryIntervalMs;
     int discoveryTimeoutMs;
+    bool deltaGossip = true;       // ship only lists changed since the last round
+    int fullSyncEveryRounds = 10;  // every N-th round reconciles the whole db as a safety net
+    bool digestSync = true;        // reconcile via Merkle digests instead of shipping the whole db
+    int eagerFanout = 3;           // replicas a client write is pushed to right away
+    DurabilityOptions durability;  // journal mode, fsync level and group commit window
+    size_t cacheBudgetBytes = 8 << 20; // in-memory budget for hot lists, written back each round
+    int clientWorkers = 4;         // threads serving client requests; 0 serves them on the loop thread
+    ThreadingMode threading = ThreadingMode::SPLIT;
+    int migrationBatchLists = 256; // lists streamed to a new shard per gossip tick while resharding
+    int migrationAckTimeoutMs = 2000; // unacknowledged migration batches are resent after this
+    bool joining = false;          // replica of a shard being filled; hidden from clients until complete_join
+    int gossipChunkLists = 512;    // lists per message when a full-state round streams the db
+};
+
+// Progress of streaming this node's share of a new shard to its replicas
+struct MigrationStatus {
+    bool active = false;
+    int targetShard = -1;
+    double scanned = 0;        // fraction of the local key space walked so far
+    uint64_t listsSent = 0;
+    uint64_t bytesSent = 0;
+    size_t pendingLists = 0;   // changed during handoff, still to be resent
+    size_t unackedLists = 0;   // sent, not yet confirmed durable by the new shard
+    double listsPerSec = 0;
+    bool complete = false;     // everything confirmed, ready for cutover
 };
 
 class Node {
@@ -39,38 +82,165 @@ public:
     void stop();
     void run_loop();
 
+    uint64_t cache_hits() const;
+    uint64_t cache_misses() const;
+    std::string latency_report() const;
+
+    // Resharding: start streaming the lists a shard added with the given
+    // weight would own to that shard's replicas (which must already be
+    // known through discovery), while still serving them here. Once the
+    // status reports complete, finish_migration switches to the grown ring
+    // and drops the lists that moved away. Replicas of the new shard start
+    // joining and only advertise their weight once complete_join is called.
+    bool begin_migration(int newShardId, uint32_t weight);
+    MigrationStatus migration_status();
+    bool finish_migration();
+    void complete_join();
+
 private:
+    void client_loop();
+    void gossip_loop();
+    void discovery_loop();
+    void client_step(bool requestReady, bool replyReady);
+    void gossip_step(bool frameReady, uint64_t& nextStateGossipTs);
+    void discovery_step(bool frameReady, uint64_t& nextDiscoveryGossipTs);
+
     void handle_client_frame();
+    void forward_client_reply();
+    void send_client_reply(std::vector<zmq::message_t>& envelope, zmq::message_t payload);
+    zmq::message_t serve_client_request(message::Message m);
+    void worker_loop(size_t index);
+    void drain_pending_fanout();
+    void migrate_step();
     void handle_gossip_frame();
     void handle_discovery_frame();
 
+    std::optional<ShoppingList> load_list(const std::string& listId);
+    std::vector<std::optional<ShoppingList>> load_lists(const std::vector<std::string>& ids);
+    void store_list(const ShoppingList& list);
+    void store_evicted(const std::vector<ShoppingList>& evicted);
+    void flush_cache();
+    void recover_rolled_back();
+
     void apply_message(const message::Message& m);
-    void eager_fanout();
+    ShoppingList ensure_list(const ShoppingList& incomingList);
+    void merge_lists(const std::vector<ShoppingList>& lists);
+    void mark_changed(const std::string& listId);
+    void eager_fanout(const ShoppingList& list);
     void perform_shard_gossip();
+    void gossip_full_state();
+    void gossip_changes();
+    void push_shard_message(const message::Message& m, size_t copies = 1);
+    void send_to_node(const std::string& nodeId, const message::Message& m);
+    void start_digest_exchange();
+    void handle_digest_nodes(const message::Message& m, std::vector<message::Message>& replies);
+    void handle_digest_leaves(const message::Message& m, std::vector<message::Message>& replies);
+    void handle_migrate_lists(const message::Message& m, std::vector<message::Message>& replies);
+    void handle_migrate_ack(const message::Message& m);
+    std::vector<message::DigestEntry> leaf_digests(const std::vector<uint32_t>& leaves) const;
     void perform_discovery_gossip();
     void evict_dead_nodes();
     void update_known_nodes(const std::vector<message::NodeInfo>& nodes);
+    void queue_peer_change(bool connect, const std::string& nodeId, const std::string& endpoint);
+    void apply_peer_changes();
 
     int shard_for_list(const std::string& listId) const;
+    bool owns_list(const std::string& listId) const;
     uint64_t next_gossip_ts(uint64_t interval) const;
 
     void handle_peer(const message::NodeInfo& n, uint64_t now = 0);
 
 private:
     NodeConfig cfg;
+    HashRing ring;
+    mutable std::shared_mutex ringMutex; // ring is read by the client thread and swapped on cutover
     zmq::context_t ctx;
-    zmq::socket_t repSock;
+    zmq::socket_t routerSock;
+    zmq::socket_t replyPullSock; // replies of the client workers, sent on by the loop thread
     zmq::socket_t gossipPushSock;
     zmq::socket_t gossipPullSock;
     zmq::socket_t discoveryPushSock;
     zmq::socket_t discoveryPullSock;
 
-    std::unordered_map<std::string, message::NodeInfo> knownNodes;
-    std::unordered_set<std::string> connectedDiscovery;
-    std::unordered_set<std::string> connectedShard;
+    std::unordered_map<std::string, message::NodeInfo> knownNodes; // guarded by nodesMutex
+    std::mutex nodesMutex;
+    std::unordered_set<std::string> connectedDiscovery; // discovery thread only
+    std::unordered_set<std::string> connectedShard;     // gossip thread only
+    // PUSH socket per node for replies that must reach one sender, such as
+    // the steps of a digest exchange; gossip thread only
+    std::unordered_map<std::string, zmq::socket_t> nodeSocks;
+
+    // Shard membership changes found by discovery, applied to the gossip
+    // PUSH socket by the thread that owns it
+    struct PeerChange {
+        bool connect = false;
+        std::string nodeId;
+        std::string endpoint;
+    };
+    BoundedQueue<PeerChange> peerChanges{1024};
+
+    uint64_t gossipCursor = 0; // db change feed position shipped by the last delta round; gossip thread only
+    std::unordered_map<std::string, uint64_t> fannedOut; // digest a list was pushed to every replica with
+    uint64_t gossipRound = 0;
 
     SqliteDb db;
-    std::thread loopThread;
+    ListCache cache;
+
+    // Guards the cache, the db's consistency with it and fannedOut, which
+    // the gossip thread and the client workers share. SqliteDb locks
+    // itself, so the gossip thread reads pages and the change feed without it.
+    std::mutex stateMutex;
+    BoundedQueue<ShoppingList> fanoutQueue{4096}; // client writes the gossip thread still has to push
+
+    // Outgoing resharding state, guarded by stateMutex
+    struct Migration {
+        bool active = false;
+        int targetShard = -1;
+        HashRing nextRing;
+        uint32_t nextLeaf = 0;                  // Merkle leaf the scan continues at
+        std::unordered_set<std::string> pending; // moving lists written since they were sent
+        struct Unacked {
+            uint64_t digest;
+            uint64_t sentMs;
+        };
+        std::unordered_map<std::string, Unacked> awaiting;  // sent, ack outstanding
+        std::unordered_map<std::string, uint64_t> confirmed; // digest the new shard acked
+        std::vector<std::string> dropping;      // moved away at cutover, still to delete here
+        std::vector<std::string> endpoints;     // gossip endpoints of the new shard
+        uint64_t startedMs = 0;
+        uint64_t listsSent = 0;
+        uint64_t bytesSent = 0;
+    };
+    Migration migration;
+    zmq::socket_t migrationPushSock;             // gossip thread only
+    std::vector<std::string> migrationConnected; // endpoints migrationPushSock is connected to
+
+    struct ClientJob {
+        std::vector<zmq::message_t> envelope; // ROUTER routing frames, echoed on the reply
+        message::Message request;
+        uint64_t receivedUs = 0;
+    };
+
+    struct ClientWorker {
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::deque<ClientJob> jobs;
+        std::thread thread;
+    };
+
+    // Requests for a list always go to the same worker, so writes to one
+    // list are applied in arrival order
+    std::vector<std::unique_ptr<ClientWorker>> workers;
+
+    LatencyHistogram clientLatency;    // request received to reply sent
+    LatencyHistogram clientLockWait;   // client requests waiting for stateMutex
+    LatencyHistogram gossipLatency;    // per ingested frame and per outgoing round
+    LatencyHistogram gossipLockHold;   // stateMutex held by the gossip thread, per acquisition
+    LatencyHistogram discoveryLatency; // per ingested frame and per outgoing round
+
+    std::thread loopThread; // the single loop, or the client thread when split
+    std::thread gossipThread;
+    std::thread discoveryThread;
     std::atomic<bool> running;
 };
 
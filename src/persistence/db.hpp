@@ -8,6 +8,22 @@
 #include <vector>
 #include <string>
 
+enum class JournalMode { ROLLBACK, WAL };
+
+enum class SyncLevel { OFF, NORMAL, FULL };
+
+struct DurabilityOptions {
+    JournalMode journal = JournalMode::WAL;
+    SyncLevel sync = SyncLevel::NORMAL;
+    int groupCommitMs = 0; // writes within this window share one commit; 0 commits each write
+};
+
+// A list together with the sequence number of its latest write
+struct ChangedList {
+    uint64_t seq;
+    ShoppingList list;
+};
+
 class IDb {
 public:
     virtual ~IDb() = default;
@@ -26,9 +42,19 @@ public:
 
     virtual bool delete_many(const std::vector<std::string>& listIds) = 0;
 
-    virtual std::vector<ShoppingList> read_all() = 0;
+    // Keyset cursor: up to limit lists with ids after afterId in id order.
+    // Pass the last id of a page to get the next one; empty afterId starts over.
+    virtual std::vector<ShoppingList> read_page(const std::string& afterId, size_t limit) = 0;
 
     virtual std::vector<std::string> get_all_list_ids() = 0;
+
+    // Change feed: every write stamps the row with the next sequence number,
+    // so this returns lists written after seq (oldest first, at most limit).
+    // Feed the last returned seq back in to continue; deleted lists drop out.
+    virtual std::vector<ChangedList> read_changed_since(uint64_t seq, size_t limit) = 0;
+
+    // Highest sequence number handed out so far
+    virtual uint64_t last_seq() const = 0;
 };
 
 #endif
@@ -0,0 +1,94 @@
+#ifndef MERKLE_TREE_HPP
+#define MERKLE_TREE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "../util.hpp"
+
+// Hash tree over (list id, content hash) pairs. Lists are bucketed into
+// leaves by their id hash; every node holds the wrapping sum of the entry
+// hashes below it, so a write only touches the nodes on one leaf-to-root path.
+// Nodes are numbered heap style: root is 1, children of n are 2n and 2n + 1.
+class MerkleTree {
+public:
+    static constexpr uint32_t DEPTH = 12;
+    static constexpr uint32_t LEAVES = 1u << DEPTH;
+    static constexpr uint32_t ROOT = 1;
+
+    MerkleTree(): nodes(2 * LEAVES, 0), leaves(LEAVES) {}
+
+    void update(const std::string& listId, uint64_t contentHash) {
+        uint32_t leaf = leaf_for(listId);
+        auto& bucket = leaves[leaf - LEAVES];
+        uint64_t delta = entry_hash(listId, contentHash);
+
+        auto it = bucket.find(listId);
+        if (it != bucket.end()) {
+            if (it->second == contentHash) return;
+            delta -= entry_hash(listId, it->second);
+            it->second = contentHash;
+        } else {
+            bucket.emplace(listId, contentHash);
+        }
+        propagate(leaf, delta);
+    }
+
+    void remove(const std::string& listId) {
+        uint32_t leaf = leaf_for(listId);
+        auto& bucket = leaves[leaf - LEAVES];
+        auto it = bucket.find(listId);
+        if (it == bucket.end()) return;
+
+        propagate(leaf, 0 - entry_hash(listId, it->second));
+        bucket.erase(it);
+    }
+
+    void clear() {
+        std::fill(nodes.begin(), nodes.end(), 0);
+        for (auto& bucket : leaves) bucket.clear();
+    }
+
+    uint64_t root() const {
+        return nodes[ROOT];
+    }
+
+    uint64_t node(uint32_t index) const {
+        return valid(index) ? nodes[index] : 0;
+    }
+
+    static bool valid(uint32_t index) {
+        return index >= ROOT && index < 2 * LEAVES;
+    }
+
+    static bool is_leaf(uint32_t index) {
+        return index >= LEAVES && index < 2 * LEAVES;
+    }
+
+    // Content hashes of the lists stored under a leaf node
+    const std::unordered_map<std::string, uint64_t>& leaf_entries(uint32_t index) const {
+        return leaves[index - LEAVES];
+    }
+
+    static uint32_t leaf_for(const std::string& listId) {
+        return LEAVES + static_cast<uint32_t>(Util::hash64(listId) >> (64 - DEPTH));
+    }
+
+private:
+    std::vector<uint64_t> nodes;
+    std::vector<std::unordered_map<std::string, uint64_t>> leaves;
+
+    static uint64_t entry_hash(const std::string& listId, uint64_t contentHash) {
+        return Util::mix64(Util::hash64(listId) ^ contentHash);
+    }
+
+    void propagate(uint32_t leaf, uint64_t delta) {
+        for (uint32_t n = leaf; n >= ROOT; n >>= 1)
+            nodes[n] += delta;
+    }
+};
+
+#endif
@@ -5,10 +5,60 @@
 #include <optional>
 #include <msgpack.hpp>
 #include <iostream>
+#include <random>
+#include <cstdio>
 
 using namespace std;
 
+// Serialization scaffolding is per thread and reused: the pack buffer keeps
+// its capacity across clear(), the zone keeps its first chunk. Blobs are
+// bound with SQLITE_TRANSIENT and lists are converted before the zone is
+// cleared, so nothing outlives the next call.
+static const msgpack::sbuffer& pack_list(const ShoppingList& list) {
+    thread_local msgpack::sbuffer buffer;
+    buffer.clear();
+    msgpack::pack(buffer, list);
+    return buffer;
+}
+
+// Strings may point into the row's blob; they are copied out by convert
+static bool reference_blob(msgpack::type::object_type, size_t, void*) {
+    return true;
+}
+
+static ShoppingList decode_list(const void* data, int size) {
+    thread_local msgpack::zone zone;
+    ShoppingList list;
+    try {
+        msgpack::object obj = msgpack::unpack(zone, reinterpret_cast<const char*>(data), size, reference_blob);
+        obj.convert(list);
+    } catch (...) {
+        zone.clear();
+        throw;
+    }
+    zone.clear();
+    return list;
+}
+
+// Every row was decoded when the database was opened (see upgrade_format),
+// so a row failing here was damaged since. It is logged and skipped, so it
+// cannot fail the whole read or the thread doing it; the row itself stays.
+static optional<ShoppingList> unpack_list(const void* data, int size) {
+    try {
+        return decode_list(data, size);
+    } catch (const exception& e) {
+        cerr << "Skipping undecodable list row: " << e.what() << endl;
+        return nullopt;
+    }
+}
+
 SqliteDb::~SqliteDb() {
+    if (db) flush(true);
+
+    for (auto& [sql, stmt] : statements)
+        sqlite3_finalize(stmt);
+    statements.clear();
+
     if (db) {
         sqlite3_close(db);
         db = nullptr;
@@ -16,20 +66,136 @@ SqliteDb::~SqliteDb() {
 }
 
 bool SqliteDb::init_db(const string& dbPath) {
+    return init_db(dbPath, DurabilityOptions{});
+}
+
+bool SqliteDb::init_db(const string& dbPath, const DurabilityOptions& options) {
+    lock_guard<recursive_mutex> lk(mtx);
     if (sqlite3_open(dbPath.c_str(), &db) != SQLITE_OK) {
         cerr << "Failed to open DB: " << sqlite3_errmsg(db) << endl;
         db = nullptr;
         return false;
     }
-    return create_schema();
+    durability = options;
+    if (!apply_durability() || !create_schema()) return false;
+    if (!upgrade_format()) {
+        // Serving without the rows that did not decode would lose them
+        sqlite3_close(db);
+        db = nullptr;
+        return false;
+    }
+    return load_merkle();
+}
+
+bool SqliteDb::apply_durability() {
+    // journal_mode answers with the mode it ended up in, which may differ
+    // from the requested one (e.g. WAL is not available on every filesystem)
+    string sql = durability.journal == JournalMode::WAL ?
+        "PRAGMA journal_mode=WAL;" : "PRAGMA journal_mode=DELETE;";
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        cerr << "Failed to set journal mode: " << sqlite3_errmsg(db) << endl;
+        return false;
+    }
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        const char* mode = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        if (mode) journalMode = mode;
+    }
+    sqlite3_finalize(stmt);
+
+    const char* sync =
+        durability.sync == SyncLevel::OFF ? "PRAGMA synchronous=OFF;" :
+        durability.sync == SyncLevel::NORMAL ? "PRAGMA synchronous=NORMAL;" :
+        "PRAGMA synchronous=FULL;";
+    char* errmsg = nullptr;
+    if (sqlite3_exec(db, sync, nullptr, nullptr, &errmsg) != SQLITE_OK) {
+        if (errmsg) cerr << "Failed to set synchronous level: " << errmsg << endl;
+        sqlite3_free(errmsg);
+        return false;
+    }
+    return true;
+}
+
+string SqliteDb::durability_summary() const {
+    const char* sync =
+        durability.sync == SyncLevel::OFF ? "OFF" :
+        durability.sync == SyncLevel::NORMAL ? "NORMAL" : "FULL";
+    return "journal=" + journalMode + " synchronous=" + sync +
+        " groupCommit=" + to_string(durability.groupCommitMs) + "ms";
+}
+
+// With group commit the transaction opened by the first write stays open and
+// later writes join it until the window passes, so they share one fsync.
+bool SqliteDb::begin_transaction() {
+    if (inTransaction) return true;
+
+    char* errmsg = nullptr;
+    if (sqlite3_exec(db, "BEGIN TRANSACTION;", nullptr, nullptr, &errmsg) != SQLITE_OK) {
+        if (errmsg) cerr << "BEGIN failed: " << errmsg << endl;
+        sqlite3_free(errmsg);
+        return false;
+    }
+    inTransaction = true;
+    transactionStartMs = Util::now_ms();
+    return true;
+}
+
+bool SqliteDb::end_transaction() {
+    if (durability.groupCommitMs > 0)
+        return flush(false);
+    return commit_transaction();
+}
+
+bool SqliteDb::commit_transaction() {
+    if (!inTransaction) return true;
+
+    char* errmsg = nullptr;
+    if (sqlite3_exec(db, "COMMIT;", nullptr, nullptr, &errmsg) != SQLITE_OK) {
+        if (errmsg) cerr << "COMMIT failed: " << errmsg << endl;
+        sqlite3_free(errmsg);
+        rollback_transaction();
+        return false;
+    }
+    inTransaction = false;
+    grouped.clear();
+    return true;
+}
+
+void SqliteDb::rollback_transaction() {
+    if (!inTransaction) return;
+    sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+    inTransaction = false;
+    // Grouped writes of earlier calls are gone as well, although those calls
+    // reported success; hand them back and resync the digest
+    rolledBack.insert(rolledBack.end(), make_move_iterator(grouped.begin()), make_move_iterator(grouped.end()));
+    grouped.clear();
+    load_merkle();
+}
+
+vector<ShoppingList> SqliteDb::take_rolled_back() {
+    lock_guard<recursive_mutex> lk(mtx);
+    vector<ShoppingList> lists;
+    lists.swap(rolledBack);
+    return lists;
+}
+
+bool SqliteDb::flush(bool force) {
+    lock_guard<recursive_mutex> lk(mtx);
+    if (!inTransaction) return true;
+    if (!force && Util::now_ms() - transactionStartMs < static_cast<uint64_t>(durability.groupCommitMs))
+        return true;
+    return commit_transaction();
 }
 
 bool SqliteDb::create_schema() {
     const char* sql =
         "CREATE TABLE IF NOT EXISTS lists ("
         "id TEXT PRIMARY KEY, "
-        "data BLOB NOT NULL"
-        ");";
+        "data BLOB NOT NULL, "
+        "hash INTEGER NOT NULL DEFAULT 0, "
+        "seq INTEGER NOT NULL DEFAULT 0"
+        ");"
+        "CREATE TABLE IF NOT EXISTS meta (key TEXT PRIMARY KEY, value TEXT NOT NULL);";
 
     char* errmsg = nullptr;
     int rc = sqlite3_exec(db, sql, nullptr, nullptr, &errmsg);
@@ -40,30 +206,217 @@ bool SqliteDb::create_schema() {
         }
         return false;
     }
+
+    // Databases created before content hashes and sequence numbers were
+    // stored lack those columns
+    bool hasHash = false, hasSeq = false;
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, "PRAGMA table_info(lists);", -1, &stmt, nullptr) != SQLITE_OK) return false;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        const char* col = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        if (col && string(col) == "hash") hasHash = true;
+        if (col && string(col) == "seq") hasSeq = true;
+    }
+    sqlite3_finalize(stmt);
+
+    string migration;
+    if (!hasHash) migration += "ALTER TABLE lists ADD COLUMN hash INTEGER NOT NULL DEFAULT 0;";
+    // Existing rows get distinct sequence numbers in insertion order
+    if (!hasSeq) migration += "ALTER TABLE lists ADD COLUMN seq INTEGER NOT NULL DEFAULT 0;"
+                              "UPDATE lists SET seq = rowid;";
+    migration += "CREATE INDEX IF NOT EXISTS lists_seq ON lists(seq);";
+
+    if (sqlite3_exec(db, migration.c_str(), nullptr, nullptr, &errmsg) != SQLITE_OK) {
+        if (errmsg) {
+            cerr << "Failed to migrate schema: " << errmsg << endl;
+            sqlite3_free(errmsg);
+        }
+        return false;
+    }
+
+    if (sqlite3_prepare_v2(db, "SELECT COALESCE(MAX(seq), 0) FROM lists;", -1, &stmt, nullptr) != SQLITE_OK) return false;
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+        lastSeq = static_cast<uint64_t>(sqlite3_column_int64(stmt, 0));
+    sqlite3_finalize(stmt);
+    return load_replica_id();
+}
+
+// The first open draws a random id and stores it; later opens read it back
+bool SqliteDb::load_replica_id() {
+    random_device rd;
+    char fresh[17];
+    snprintf(fresh, sizeof(fresh), "%08x%08x", rd(), rd());
+
+    sqlite3_stmt* stmt;
+    const char* insert = "INSERT OR IGNORE INTO meta (key, value) VALUES ('replica_id', ?);";
+    if (sqlite3_prepare_v2(db, insert, -1, &stmt, nullptr) != SQLITE_OK) return false;
+    sqlite3_bind_text(stmt, 1, fresh, -1, SQLITE_TRANSIENT);
+    bool ok = sqlite3_step(stmt) == SQLITE_DONE;
+    sqlite3_finalize(stmt);
+    if (!ok) {
+        cerr << "Failed to store replica id: " << sqlite3_errmsg(db) << endl;
+        return false;
+    }
+
+    if (sqlite3_prepare_v2(db, "SELECT value FROM meta WHERE key = 'replica_id';", -1, &stmt, nullptr) != SQLITE_OK)
+        return false;
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+        replicaId = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+    sqlite3_finalize(stmt);
+    return !replicaId.empty();
+}
+
+const string& SqliteDb::replica_id() const {
+    return replicaId;
+}
+
+// user_version holds the list encoding the rows are stored in. Rows of an
+// older one (ShoppingList's ORSet decodes its legacy encodings) are rewritten
+// in the current one, with fresh hashes, in a single transaction. A row that
+// does not decode fails the open and nothing is changed.
+bool SqliteDb::upgrade_format() {
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, "PRAGMA user_version;", -1, &stmt, nullptr) != SQLITE_OK) return false;
+    int version = sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int(stmt, 0) : 0;
+    sqlite3_finalize(stmt);
+    if (version >= LIST_FORMAT) return true;
+
+    vector<pair<string, ShoppingList>> rows;
+    size_t failed = 0;
+    if (sqlite3_prepare_v2(db, "SELECT id, data FROM lists;", -1, &stmt, nullptr) != SQLITE_OK) return false;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        const char* uid_text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        const void* blob_data = sqlite3_column_blob(stmt, 1);
+        int blob_size = sqlite3_column_bytes(stmt, 1);
+        if (!uid_text || !blob_data || blob_size <= 0) continue;
+        try {
+            rows.emplace_back(uid_text, decode_list(blob_data, blob_size));
+        } catch (const exception& e) {
+            cerr << "List " << uid_text << " does not decode: " << e.what() << endl;
+            failed++;
+        }
+    }
+    sqlite3_finalize(stmt);
+    if (failed > 0) {
+        cerr << "Refusing to open the database: " << failed << " list(s) in format "
+             << version << " do not decode" << endl;
+        return false;
+    }
+
+    const char* update = "UPDATE lists SET data = ?, hash = ? WHERE id = ?;";
+    if (sqlite3_exec(db, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr) != SQLITE_OK) return false;
+    if (sqlite3_prepare_v2(db, update, -1, &stmt, nullptr) != SQLITE_OK) {
+        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        return false;
+    }
+
+    bool ok = true;
+    for (const auto& [id, list] : rows) {
+        const msgpack::sbuffer& buffer = pack_list(list);
+        sqlite3_bind_blob(stmt, 1, buffer.data(), buffer.size(), SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt, 2, static_cast<sqlite3_int64>(list.digest()));
+        sqlite3_bind_text(stmt, 3, id.c_str(), -1, SQLITE_TRANSIENT);
+        ok = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_reset(stmt);
+        if (!ok) break;
+    }
+    sqlite3_finalize(stmt);
+
+    string done = "PRAGMA user_version = " + to_string(LIST_FORMAT) + "; COMMIT;";
+    if (!ok || sqlite3_exec(db, done.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK) {
+        cerr << "Failed to upgrade lists to format " << LIST_FORMAT << ": " << sqlite3_errmsg(db) << endl;
+        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        return false;
+    }
+    if (!rows.empty())
+        cout << "Upgraded " << rows.size() << " list(s) from format " << version << " to " << LIST_FORMAT << endl;
     return true;
 }
 
-bool SqliteDb::write(const ShoppingList& list) {
-    msgpack::sbuffer buffer;
-    msgpack::pack(buffer, list);
+bool SqliteDb::load_merkle() {
+    tree.clear();
 
+    vector<ShoppingList> unhashed;
     sqlite3_stmt* stmt;
-    const char* sql = "INSERT OR REPLACE INTO lists (id, data) VALUES (?, ?);";
+    const char* sql = "SELECT id, hash, data FROM lists;";
     if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) return false;
 
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        const char* uid_text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        if (!uid_text) continue;
+
+        uint64_t hash = static_cast<uint64_t>(sqlite3_column_int64(stmt, 1));
+        if (hash != 0) {
+            tree.update(uid_text, hash);
+            continue;
+        }
+
+        // Rows written before the hash column existed: hash them once now
+        const void* blob_data = sqlite3_column_blob(stmt, 2);
+        int blob_size = sqlite3_column_bytes(stmt, 2);
+        if (blob_data && blob_size > 0) {
+            optional<ShoppingList> list = unpack_list(blob_data, blob_size);
+            if (list.has_value()) unhashed.push_back(move(*list));
+        }
+    }
+    sqlite3_finalize(stmt);
+
+    return unhashed.empty() || write_many(unhashed);
+}
+
+// Statements are compiled once per connection and reused; callers reset them
+// when done so they do not hold read locks between calls. Callers hold mtx
+// from prepare until the reset, as a statement can only serve one of them.
+sqlite3_stmt* SqliteDb::prepare(string_view sql) {
+    auto it = statements.find(sql);
+    if (it != statements.end()) {
+        sqlite3_reset(it->second);
+        sqlite3_clear_bindings(it->second);
+        return it->second;
+    }
+
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, sql.data(), static_cast<int>(sql.size()), &stmt, nullptr) != SQLITE_OK) {
+        cerr << "Failed to prepare statement: " << sqlite3_errmsg(db) << endl;
+        return nullptr;
+    }
+    statements.emplace(sql, stmt);
+    return stmt;
+}
+
+const MerkleTree& SqliteDb::merkle() const {
+    return tree;
+}
+
+bool SqliteDb::write(const ShoppingList& list) {
+    lock_guard<recursive_mutex> lk(mtx);
+    const msgpack::sbuffer& buffer = pack_list(list);
+    uint64_t hash = list.digest();
+
+    sqlite3_stmt* stmt = prepare("INSERT OR REPLACE INTO lists (id, data, hash, seq) VALUES (?, ?, ?, ?);");
+    if (!stmt) return false;
+    if (durability.groupCommitMs > 0 && !begin_transaction()) return false;
+
     sqlite3_bind_text(stmt, 1, list.getUid().c_str(), -1, SQLITE_TRANSIENT);
     sqlite3_bind_blob(stmt, 2, buffer.data(), buffer.size(), SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 3, static_cast<sqlite3_int64>(hash));
+    sqlite3_bind_int64(stmt, 4, static_cast<sqlite3_int64>(lastSeq + 1));
 
     bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
-    if (!ok) cerr << "Write failed: " << sqlite3_errmsg(db) << endl;
-    sqlite3_finalize(stmt);
-    return ok;
+    if (ok) {
+        tree.update(list.getUid(), hash);
+        lastSeq++;
+        if (durability.groupCommitMs > 0) grouped.push_back(list);
+    }
+    else cerr << "Write failed: " << sqlite3_errmsg(db) << endl;
+    sqlite3_reset(stmt);
+    return end_transaction() && ok;
 }
 
 optional<ShoppingList> SqliteDb::read(const string& listId) {
-    sqlite3_stmt* stmt;
-    const char* sql = "SELECT data FROM lists WHERE id = ?;";
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) return nullopt;
+    lock_guard<recursive_mutex> lk(mtx);
+    sqlite3_stmt* stmt = prepare("SELECT data FROM lists WHERE id = ?;");
+    if (!stmt) return nullopt;
 
     sqlite3_bind_text(stmt, 1, listId.c_str(), -1, SQLITE_TRANSIENT);
 
@@ -72,125 +425,124 @@ optional<ShoppingList> SqliteDb::read(const string& listId) {
         const void* blob_data = sqlite3_column_blob(stmt, 0);
         int blob_size = sqlite3_column_bytes(stmt, 0);
         if (blob_data && blob_size > 0) {
-            msgpack::object_handle oh = msgpack::unpack(reinterpret_cast<const char*>(blob_data), blob_size);
-            ShoppingList list;
-            oh.get().convert(list);
-            result = move(list);
+            result = unpack_list(blob_data, blob_size);
         }
     }
 
-    sqlite3_finalize(stmt);
+    sqlite3_reset(stmt);
     return result;
 }
 
 bool SqliteDb::delete_list(const string& listId) {
-    sqlite3_stmt* stmt;
-    const char* sql = "DELETE FROM lists WHERE id = ?;";
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) return false;
+    lock_guard<recursive_mutex> lk(mtx);
+    sqlite3_stmt* stmt = prepare("DELETE FROM lists WHERE id = ?;");
+    if (!stmt) return false;
+    if (durability.groupCommitMs > 0 && !begin_transaction()) return false;
 
     sqlite3_bind_text(stmt, 1, listId.c_str(), -1, SQLITE_TRANSIENT);
     bool ok = (sqlite3_step(stmt) == SQLITE_DONE);
-    if (!ok) cerr << "Delete failed: " << sqlite3_errmsg(db) << endl;
-    sqlite3_finalize(stmt);
-    return ok;
+    if (ok) tree.remove(listId);
+    else cerr << "Delete failed: " << sqlite3_errmsg(db) << endl;
+    sqlite3_reset(stmt);
+    return end_transaction() && ok;
 }
 
 bool SqliteDb::write_many(const vector<ShoppingList>& lists) {
+    lock_guard<recursive_mutex> lk(mtx);
     if (!db) return false;
+    if (lists.empty()) return true;
 
-    char* errmsg = nullptr;
-    if (sqlite3_exec(db, "BEGIN TRANSACTION;", nullptr, nullptr, &errmsg) != SQLITE_OK) {
-        if (errmsg) cerr << "BEGIN failed: " << errmsg << endl;
-        sqlite3_free(errmsg);
-        return false;
-    }
-
-    sqlite3_stmt* stmt;
-    const char* sql = "INSERT OR REPLACE INTO lists (id, data) VALUES (?, ?);";
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
-        return false;
-    }
+    sqlite3_stmt* stmt = prepare("INSERT OR REPLACE INTO lists (id, data, hash, seq) VALUES (?, ?, ?, ?);");
+    if (!stmt || !begin_transaction()) return false;
 
     bool all_ok = true;
     for (const auto& list : lists) {
         sqlite3_reset(stmt);
         sqlite3_clear_bindings(stmt);
 
-        msgpack::sbuffer buffer;
-        msgpack::pack(buffer, list);
+        const msgpack::sbuffer& buffer = pack_list(list);
+        uint64_t hash = list.digest();
 
         sqlite3_bind_text(stmt, 1, list.getUid().c_str(), -1, SQLITE_TRANSIENT);
         sqlite3_bind_blob(stmt, 2, buffer.data(), buffer.size(), SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt, 3, static_cast<sqlite3_int64>(hash));
+        sqlite3_bind_int64(stmt, 4, static_cast<sqlite3_int64>(lastSeq + 1));
 
         if (sqlite3_step(stmt) != SQLITE_DONE) {
             all_ok = false;
             cerr << "Batch write failed for " << list.getUid() << ": " << sqlite3_errmsg(db) << endl;
+        } else {
+            tree.update(list.getUid(), hash);
+            lastSeq++;
+            if (durability.groupCommitMs > 0) grouped.push_back(list);
         }
     }
 
-    sqlite3_finalize(stmt);
-    if (sqlite3_exec(db, "COMMIT;", nullptr, nullptr, &errmsg) != SQLITE_OK) {
-        if (errmsg) cerr << "COMMIT failed: " << errmsg << endl;
-        sqlite3_free(errmsg);
-        return false;
-    }
-
-    return all_ok;
+    sqlite3_reset(stmt);
+    return end_transaction() && all_ok;
 }
 
+// Ids are looked up in chunks of at most READ_CHUNK. Chunk sizes are rounded
+// up to a power of two (padding repeats the last id), so at most a handful of
+// IN (...) statements exist and each is prepared once and then reused.
 vector<optional<ShoppingList>> SqliteDb::read_many(const vector<string>& listIds) {
-    if (listIds.empty()) return {};
+    lock_guard<recursive_mutex> lk(mtx);
+    vector<optional<ShoppingList>> results(listIds.size());
+    if (!db || listIds.empty()) return results;
 
-    vector<optional<ShoppingList>> results;
-    string sql = "SELECT id, data FROM lists WHERE id IN (";
+    unordered_map<string_view, vector<size_t>> positions;
+    vector<string_view> unique;
     for (size_t i = 0; i < listIds.size(); ++i) {
-        sql += (i == listIds.size() - 1) ? "?) " : "?, ";
+        auto& slots = positions[listIds[i]];
+        if (slots.empty()) unique.push_back(listIds[i]);
+        slots.push_back(i);
     }
 
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-        cerr << "Failed to prepare batch read: " << sqlite3_errmsg(db) << endl;
-        return results;
-    }
+    size_t maxChunk = min<size_t>(READ_CHUNK, sqlite3_limit(db, SQLITE_LIMIT_VARIABLE_NUMBER, -1));
+    for (size_t begin = 0; begin < unique.size(); begin += maxChunk) {
+        size_t count = min(maxChunk, unique.size() - begin);
+        size_t width = 1;
+        while (width < count) width <<= 1;
+        width = min(width, maxChunk);
 
-    for (size_t i = 0; i < listIds.size(); ++i) {
-        sqlite3_bind_text(stmt, static_cast<int>(i + 1), listIds[i].c_str(), -1, SQLITE_TRANSIENT);
-    }
+        string sql = "SELECT id, data FROM lists WHERE id IN (?";
+        for (size_t i = 1; i < width; ++i) sql += ", ?";
+        sql += ");";
 
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        const char* uid_text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
-        const void* blob_data = sqlite3_column_blob(stmt, 1);
-        int blob_size = sqlite3_column_bytes(stmt, 1);
+        sqlite3_stmt* stmt = prepare(sql);
+        if (!stmt) return results;
 
-        if (uid_text && blob_data && blob_size > 0) {
-            msgpack::object_handle oh = msgpack::unpack(reinterpret_cast<const char*>(blob_data), blob_size);
-            ShoppingList list;
-            oh.get().convert(list);
-            results.push_back(move(list));
+        for (size_t i = 0; i < width; ++i) {
+            string_view id = unique[begin + min(i, count - 1)];
+            sqlite3_bind_text(stmt, static_cast<int>(i + 1), id.data(), static_cast<int>(id.size()), SQLITE_STATIC);
         }
-    }
 
-    sqlite3_finalize(stmt);
+        // Rows come back in SQLite's order; place each one where it was asked for
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            const char* uid_text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+            const void* blob_data = sqlite3_column_blob(stmt, 1);
+            int blob_size = sqlite3_column_bytes(stmt, 1);
+            if (!uid_text || !blob_data || blob_size <= 0) continue;
+
+            auto it = positions.find(uid_text);
+            if (it == positions.end()) continue;
+            optional<ShoppingList> list = unpack_list(blob_data, blob_size);
+            if (!list.has_value()) continue;
+            for (size_t j = 1; j < it->second.size(); j++)
+                results[it->second[j]] = list;
+            results[it->second[0]] = move(list);
+        }
+        sqlite3_reset(stmt);
+    }
     return results;
 }
 
 bool SqliteDb::delete_many(const vector<string>& listIds) {
+    lock_guard<recursive_mutex> lk(mtx);
     if (!db || listIds.empty()) return false;
 
-    char* errmsg = nullptr;
-    if (sqlite3_exec(db, "BEGIN TRANSACTION;", nullptr, nullptr, &errmsg) != SQLITE_OK) {
-        if (errmsg) cerr << "BEGIN failed: " << errmsg << endl;
-        sqlite3_free(errmsg);
-        return false;
-    }
-
-    sqlite3_stmt* stmt;
-    const char* sql = "DELETE FROM lists WHERE id = ?;";
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
-        return false;
-    }
+    sqlite3_stmt* stmt = prepare("DELETE FROM lists WHERE id = ?;");
+    if (!stmt || !begin_transaction()) return false;
 
     bool all_ok = true;
     for (const auto& id : listIds) {
@@ -202,51 +554,76 @@ bool SqliteDb::delete_many(const vector<string>& listIds) {
         if (sqlite3_step(stmt) != SQLITE_DONE) {
             all_ok = false;
             cerr << "Batch delete failed for " << id << ": " << sqlite3_errmsg(db) << endl;
+        } else {
+            tree.remove(id);
         }
     }
 
-    sqlite3_finalize(stmt);
-    if (sqlite3_exec(db, "COMMIT;", nullptr, nullptr, &errmsg) != SQLITE_OK) {
-        if (errmsg) cerr << "COMMIT failed: " << errmsg << endl;
-        sqlite3_free(errmsg);
-        return false;
-    }
-
-    return all_ok;
+    sqlite3_reset(stmt);
+    return end_transaction() && all_ok;
 }
 
-vector<ShoppingList> SqliteDb::read_all() {
+// Like read_changed_since, stepping stops once limit lists decoded, so a
+// short page always means the end of the table
+vector<ShoppingList> SqliteDb::read_page(const string& afterId, size_t limit) {
+    lock_guard<recursive_mutex> lk(mtx);
     vector<ShoppingList> lists;
-    const char* sql = "SELECT data FROM lists;";
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) return lists;
+    sqlite3_stmt* stmt = prepare("SELECT data FROM lists WHERE id > ? ORDER BY id;");
+    if (!stmt) return lists;
 
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
+    sqlite3_bind_text(stmt, 1, afterId.c_str(), -1, SQLITE_TRANSIENT);
+
+    while (lists.size() < limit && sqlite3_step(stmt) == SQLITE_ROW) {
         const void* blob_data = sqlite3_column_blob(stmt, 0);
         int blob_size = sqlite3_column_bytes(stmt, 0);
-        if (blob_data && blob_size > 0) {
-            msgpack::object_handle oh = msgpack::unpack(reinterpret_cast<const char*>(blob_data), blob_size);
-            ShoppingList list;
-            oh.get().convert(list);
-            lists.push_back(move(list));
-        }
+        if (!blob_data || blob_size <= 0) continue;
+        optional<ShoppingList> list = unpack_list(blob_data, blob_size);
+        if (list.has_value()) lists.push_back(move(*list));
     }
 
-    sqlite3_finalize(stmt);
+    sqlite3_reset(stmt);
     return lists;
 }
 
+// Rows stream from the seq index; stepping stops once limit lists decoded, so
+// a run of undecodable rows cannot leave a page empty and stall the cursor
+vector<ChangedList> SqliteDb::read_changed_since(uint64_t seq, size_t limit) {
+    lock_guard<recursive_mutex> lk(mtx);
+    vector<ChangedList> changes;
+    sqlite3_stmt* stmt = prepare("SELECT seq, data FROM lists WHERE seq > ? ORDER BY seq;");
+    if (!stmt) return changes;
+
+    sqlite3_bind_int64(stmt, 1, static_cast<sqlite3_int64>(seq));
+
+    while (changes.size() < limit && sqlite3_step(stmt) == SQLITE_ROW) {
+        const void* blob_data = sqlite3_column_blob(stmt, 1);
+        int blob_size = sqlite3_column_bytes(stmt, 1);
+        if (!blob_data || blob_size <= 0) continue;
+        optional<ShoppingList> list = unpack_list(blob_data, blob_size);
+        if (list.has_value())
+            changes.push_back({static_cast<uint64_t>(sqlite3_column_int64(stmt, 0)), move(*list)});
+    }
+
+    sqlite3_reset(stmt);
+    return changes;
+}
+
+uint64_t SqliteDb::last_seq() const {
+    lock_guard<recursive_mutex> lk(mtx);
+    return lastSeq;
+}
+
 vector<string> SqliteDb::get_all_list_ids() {
+    lock_guard<recursive_mutex> lk(mtx);
     vector<string> ids;
-    const char* sql = "SELECT id FROM lists;";
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) return ids;
+    sqlite3_stmt* stmt = prepare("SELECT id FROM lists;");
+    if (!stmt) return ids;
 
     while (sqlite3_step(stmt) == SQLITE_ROW) {
         const char* uid_text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
         if (uid_text) ids.emplace_back(uid_text);
     }
 
-    sqlite3_finalize(stmt);
+    sqlite3_reset(stmt);
     return ids;
 }
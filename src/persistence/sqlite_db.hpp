@@ -2,12 +2,17 @@
 #define SQLITE_DB_HPP
 
 #include "db.hpp"
+#include "merkle_tree.hpp"
 #include "../model/shopping_item.hpp"
 #include "../model/shopping_list.hpp"
 #include <sqlite3.h>
 #include <vector>
 #include <string>
 #include <optional>
+#include <unordered_map>
+#include <string_view>
+#include <functional>
+#include <mutex>
 
 class SqliteDb : public IDb {
 public:
@@ -15,6 +20,8 @@ public:
 
     bool init_db(const std::string& dbPath) override;
 
+    bool init_db(const std::string& dbPath, const DurabilityOptions& options);
+
     bool write(const ShoppingList& list) override;
 
     std::optional<ShoppingList> read(const std::string& listId) override;
@@ -27,14 +34,70 @@ public:
     
     bool delete_many(const std::vector<std::string>& listIds) override;
 
-    std::vector<ShoppingList> read_all() override;
+    std::vector<ShoppingList> read_page(const std::string& afterId, size_t limit) override;
 
     std::vector<std::string> get_all_list_ids() override;
 
+    std::vector<ChangedList> read_changed_since(uint64_t seq, size_t limit) override;
+
+    uint64_t last_seq() const override;
+
+    // Digest over every stored list, kept in sync by writes and deletes.
+    // Not guarded: callers that write from several threads must serialize.
+    const MerkleTree& merkle() const;
+
+    // Commits the open group commit transaction once its window has passed
+    // (or right away when forced). Call regularly so idle periods stay durable.
+    bool flush(bool force = false);
+
+    // Lists whose writes reported success but were lost because the group
+    // commit they joined failed. Callers that dropped their own copy after a
+    // successful write must take these back and write them again.
+    std::vector<ShoppingList> take_rolled_back();
+
+    // Random id drawn when the database was created and stored in it, so
+    // whoever owns the file keeps one replica identity across restarts
+    const std::string& replica_id() const;
+
+    // Journal mode SQLite actually applied, synchronous level and commit window
+    std::string durability_summary() const;
+
 private:
+    // Every public call holds it, so one SqliteDb can be shared between
+    // threads: cached statements, the Merkle tree and the open group commit
+    // transaction are per connection. Recursive because scans call back into
+    // reads and writes call flush.
+    mutable std::recursive_mutex mtx;
     sqlite3* db = nullptr;
+    MerkleTree tree;
+    DurabilityOptions durability;
+    std::string journalMode;
+    std::string replicaId;
+    uint64_t lastSeq = 0;
+    bool inTransaction = false;
+    uint64_t transactionStartMs = 0;
+    std::vector<ShoppingList> grouped;    // written in the open group commit transaction
+    std::vector<ShoppingList> rolledBack; // grouped writes of failed commits, see take_rolled_back
+    // Transparent hashing lets prepare() look statements up without copying the SQL
+    struct SqlHash {
+        using is_transparent = void;
+        size_t operator()(std::string_view sql) const { return std::hash<std::string_view>()(sql); }
+    };
+    std::unordered_map<std::string, sqlite3_stmt*, SqlHash, std::equal_to<>> statements;
+    static constexpr size_t READ_CHUNK = 256; // ids per read_many statement
+    // Encoding of stored rows, kept in user_version; follows the ORSet's
+    static constexpr int LIST_FORMAT = ORSet<ShoppingItem>::FORMAT;
 
     bool create_schema();
+    bool upgrade_format();
+    bool load_replica_id();
+    bool load_merkle();
+    bool apply_durability();
+    bool begin_transaction();
+    bool end_transaction();
+    bool commit_transaction();
+    void rollback_transaction();
+    sqlite3_stmt* prepare(std::string_view sql);
 };
 
 #endif
@@ -0,0 +1,90 @@
+#ifndef HASH_RING_HPP
+#define HASH_RING_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../util.hpp"
+
+// Consistent hash ring mapping list ids to shards. Every shard owns
+// weight * vnodesPerWeight points on the ring and a list belongs to the shard
+// owning the first point at or after the list's hash. Adding a shard only
+// takes over the arcs in front of its own points, so about 1/N of the lists
+// move. Node and client build the ring from the same (shard, weight) pairs
+// and hash version and therefore agree on placement.
+class HashRing {
+public:
+    static constexpr uint32_t DEFAULT_VNODES = 64;
+
+    explicit HashRing(HashVersion hashVersion = HashVersion::WYHASH,
+                      uint32_t vnodesPerWeight = DEFAULT_VNODES)
+        : version(hashVersion), vnodes(vnodesPerWeight) {}
+
+    // Ring of shards 0..numShards-1, weight 1 unless listed in weights
+    static HashRing with_shards(int numShards, const std::map<int, uint32_t>& weights = {},
+                                HashVersion hashVersion = HashVersion::WYHASH,
+                                uint32_t vnodesPerWeight = DEFAULT_VNODES) {
+        HashRing ring(hashVersion, vnodesPerWeight);
+        for (int s = 0; s < numShards; s++) {
+            auto it = weights.find(s);
+            ring.shardWeights[s] = it == weights.end() ? 1 : it->second;
+        }
+        ring.rebuild();
+        return ring;
+    }
+
+    void set_shard(int shardId, uint32_t weight = 1) {
+        if (weight == 0) {
+            remove_shard(shardId);
+            return;
+        }
+        auto it = shardWeights.find(shardId);
+        if (it != shardWeights.end() && it->second == weight) return;
+        shardWeights[shardId] = weight;
+        rebuild();
+    }
+
+    void remove_shard(int shardId) {
+        if (shardWeights.erase(shardId)) rebuild();
+    }
+
+    // Owning shard of a list, -1 while the ring is empty
+    int shard_for(const std::string& listId) const {
+        if (points.empty()) return -1;
+        uint64_t h = Util::hash(version, listId);
+        auto it = std::lower_bound(points.begin(), points.end(), std::make_pair(h, std::numeric_limits<int>::min()));
+        if (it == points.end()) it = points.begin();
+        return it->second;
+    }
+
+    bool empty() const {
+        return points.empty();
+    }
+
+    const std::map<int, uint32_t>& shards() const {
+        return shardWeights;
+    }
+
+private:
+    HashVersion version;
+    uint32_t vnodes;
+    std::map<int, uint32_t> shardWeights;
+    std::vector<std::pair<uint64_t, int>> points; // sorted by position
+
+    void rebuild() {
+        points.clear();
+        for (auto& [shardId, weight] : shardWeights) {
+            uint64_t base = Util::hash64("shard-" + std::to_string(shardId));
+            for (uint64_t i = 0; i < uint64_t(weight) * vnodes; i++)
+                points.emplace_back(Util::mix64(base + i), shardId);
+        }
+        std::sort(points.begin(), points.end());
+    }
+};
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef UTIL_HPP
+#define UTIL_HPP
+
+#include <string>
+#include <chrono>
+#include <random>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// Hash used to place lists on the shard ring. Every node and client of a
+// cluster must use the same one, so it is part of the cluster config and
+// advertised with each node; old clusters keep FNV1A until migrated.
+enum class HashVersion : uint8_t {
+    FNV1A = 1,
+    WYHASH = 2
+};
+
+class Util {
+    public:
+        // Placement hash of the given version
+        static uint64_t hash(HashVersion version, std::string_view str) {
+            return version == HashVersion::FNV1A ? hash64(str) : wyhash64(str);
+        }
+
+        // FNV-1a, stable across processes so it can be compared between replicas.
+        // Content digests and replica ids are built on it and stored, so it stays.
+        static uint64_t hash64(std::string_view str) {
+            uint64_t hash = FNV_OFFSET;
+            for (unsigned char c : str) {
+                hash ^= c;
+                hash *= FNV_PRIME;
+            }
+            return hash;
+        }
+
+        // wyhash (final4): consumes 16-48 bytes per step with 64x64->128 bit
+        // multiplies instead of one byte at a time. Reads little-endian.
+        static uint64_t wyhash64(std::string_view str, uint64_t seed = 0) {
+            const uint8_t* p = reinterpret_cast<const uint8_t*>(str.data());
+            size_t len = str.size();
+            uint64_t a, b;
+
+            seed ^= wymix(seed ^ WY_P0, WY_P1);
+            if (len <= 16) {
+                if (len >= 4) {
+                    a = (read32(p) << 32) | read32(p + ((len >> 3) << 2));
+                    b = (read32(p + len - 4) << 32) | read32(p + len - 4 - ((len >> 3) << 2));
+                } else if (len > 0) {
+                    a = (uint64_t(p[0]) << 16) | (uint64_t(p[len >> 1]) << 8) | p[len - 1];
+                    b = 0;
+                } else {
+                    a = b = 0;
+                }
+            } else {
+                size_t i = len;
+                if (i > 48) {
+                    uint64_t see1 = seed, see2 = seed;
+                    do {
+                        seed = wymix(read64(p) ^ WY_P1, read64(p + 8) ^ seed);
+                        see1 = wymix(read64(p + 16) ^ WY_P2, read64(p + 24) ^ see1);
+                        see2 = wymix(read64(p + 32) ^ WY_P3, read64(p + 40) ^ see2);
+                        p += 48;
+                        i -= 48;
+                    } while (i > 48);
+                    seed ^= see1 ^ see2;
+                }
+                while (i > 16) {
+                    seed = wymix(read64(p) ^ WY_P1, read64(p + 8) ^ seed);
+                    i -= 16;
+                    p += 16;
+                }
+                a = read64(p + i - 16);
+                b = read64(p + i - 8);
+            }
+
+            a ^= WY_P1;
+            b ^= seed;
+            __uint128_t r = static_cast<__uint128_t>(a) * b;
+            a = static_cast<uint64_t>(r);
+            b = static_cast<uint64_t>(r >> 64);
+            return wymix(a ^ WY_P0 ^ len, b ^ WY_P1);
+        }
+
+        // splitmix64 finalizer, spreads structured inputs over all 64 bits
+        static uint64_t mix64(uint64_t x) {
+            x ^= x >> 30;
+            x *= 0xbf58476d1ce4e5b9ULL;
+            x ^= x >> 27;
+            x *= 0x94d049bb133111ebULL;
+            x ^= x >> 31;
+            return x;
+        }
+
+        static uint64_t now_ms() {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+        }
+
+        // Monotonic, for measuring durations
+        static uint64_t now_us() {
+            return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        static int rand_int(int min, int max) {
+            static thread_local std::mt19937 rng(std::random_device{}());
+            std::uniform_int_distribution<int> dist(min, max);
+            return dist(rng);
+        }
+
+    private:
+        static const uint64_t FNV_OFFSET = 0xcbf29ce484222325ULL;
+        static const uint64_t FNV_PRIME = 0x100000001b3ULL;
+        static const uint64_t WY_P0 = 0xa0761d6478bd642fULL;
+        static const uint64_t WY_P1 = 0xe7037ed1a0b428dbULL;
+        static const uint64_t WY_P2 = 0x8ebc6af09c88c6e3ULL;
+        static const uint64_t WY_P3 = 0x589965cc75374cc3ULL;
+
+        static uint64_t wymix(uint64_t a, uint64_t b) {
+            __uint128_t r = static_cast<__uint128_t>(a) * b;
+            return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+        }
+
+        static uint64_t read64(const uint8_t* p) {
+            uint64_t v;
+            std::memcpy(&v, p, sizeof(v));
+            return v;
+        }
+
+        static uint64_t read32(const uint8_t* p) {
+            uint32_t v;
+            std::memcpy(&v, p, sizeof(v));
+            return v;
+        }
+};
+
+#endif
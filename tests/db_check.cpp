@@ -0,0 +1,179 @@
+// Regression checks for SqliteDb batch reads, the change feed and the Merkle
+// tree digests replicas descend to find divergent lists.
+// Build and run with `make check`.
+#include "persistence/sqlite_db.hpp"
+
+#include <cstdio>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond "\n"; \
+            failures++; \
+        } \
+    } while (0)
+
+static const std::string DB_PATH = "db_check.db";
+
+static void open_fresh(SqliteDb& db) {
+    for (const char* suffix : {"", "-wal", "-shm"})
+        std::remove((DB_PATH + suffix).c_str());
+    CHECK(db.init_db(DB_PATH));
+}
+
+static std::string list_id(int i) {
+    return "list-" + std::to_string(i);
+}
+
+// Results line up with the requested ids, across statement chunks, with
+// duplicates filled in every slot and missing ids left empty
+static void read_many_keeps_request_order() {
+    SqliteDb db;
+    open_fresh(db);
+    for (int i = 0; i < 600; i += 2)
+        db.write(ShoppingList(list_id(i), "n"));
+
+    std::vector<std::string> ids;
+    for (int i = 599; i >= 0; i--)
+        ids.push_back(list_id(i));
+    ids.push_back(list_id(10));
+    ids.push_back(list_id(11));
+    ids.push_back(list_id(10));
+
+    auto results = db.read_many(ids);
+    CHECK(results.size() == ids.size());
+    for (size_t i = 0; i < ids.size() && i < results.size(); i++) {
+        bool stored = std::stoi(ids[i].substr(5)) % 2 == 0;
+        CHECK(results[i].has_value() == stored);
+        if (results[i].has_value())
+            CHECK(results[i]->getUid() == ids[i]);
+    }
+}
+
+// Paging by the last returned seq visits every list once, in write order,
+// with its latest write only
+static void read_changed_since_pages_through_every_change() {
+    SqliteDb db;
+    open_fresh(db);
+    for (int i = 0; i < 10; i++)
+        db.write(ShoppingList(list_id(i), "n"));
+    for (int i : {3, 7, 3})
+        db.write(ShoppingList(list_id(i), "n"));
+    CHECK(db.last_seq() == 13);
+
+    std::vector<std::string> seen;
+    uint64_t cursor = 0;
+    while (true) {
+        auto page = db.read_changed_since(cursor, 4);
+        if (page.empty()) break;
+        CHECK(page.size() <= 4);
+        for (auto& change : page) {
+            CHECK(change.seq > cursor);
+            cursor = change.seq;
+            seen.push_back(change.list.getUid());
+        }
+    }
+
+    CHECK(cursor == db.last_seq());
+    CHECK(seen.size() == 10);
+    CHECK(std::set<std::string>(seen.begin(), seen.end()).size() == seen.size());
+    CHECK(!seen.empty() && seen.back() == list_id(3));
+    CHECK(db.read_changed_since(cursor, 4).empty());
+}
+
+// Walks both trees from the root like a digest exchange, descending only
+// into nodes whose hashes differ, and returns the lists found to diverge
+static std::set<std::string> descend(const MerkleTree& a, const MerkleTree& b, size_t& visited) {
+    std::set<std::string> divergent;
+    std::vector<uint32_t> frontier{MerkleTree::ROOT};
+    while (!frontier.empty()) {
+        uint32_t n = frontier.back();
+        frontier.pop_back();
+        visited++;
+        if (a.node(n) == b.node(n)) continue;
+
+        if (!MerkleTree::is_leaf(n)) {
+            frontier.push_back(2 * n);
+            frontier.push_back(2 * n + 1);
+            continue;
+        }
+        const auto& mine = a.leaf_entries(n);
+        const auto& theirs = b.leaf_entries(n);
+        for (auto& [id, hash] : mine) {
+            auto it = theirs.find(id);
+            if (it == theirs.end() || it->second != hash) divergent.insert(id);
+        }
+        for (auto& [id, hash] : theirs)
+            if (!mine.count(id)) divergent.insert(id);
+    }
+    return divergent;
+}
+
+static void merkle_descent_finds_divergent_lists() {
+    MerkleTree a, b;
+    for (int i = 0; i < 1000; i++) {
+        a.update(list_id(i), 100 + i);
+        b.update(list_id(i), 100 + i);
+    }
+    CHECK(a.root() == b.root());
+
+    b.update(list_id(5), 1);     // changed
+    b.remove(list_id(6));        // missing on one side
+    b.update(list_id(2000), 7);  // only on the other side
+    CHECK(a.root() != b.root());
+
+    size_t visited = 0;
+    auto divergent = descend(a, b, visited);
+    CHECK(divergent == std::set<std::string>({list_id(5), list_id(6), list_id(2000)}));
+    CHECK(visited < 2 * 3 * MerkleTree::DEPTH + 2); // three paths, not the whole tree
+
+    // Undoing the differences brings the digests back together
+    b.update(list_id(5), 105);
+    b.update(list_id(6), 106);
+    b.remove(list_id(2000));
+    CHECK(a.root() == b.root());
+    visited = 0;
+    CHECK(descend(a, b, visited).empty());
+    CHECK(visited == 1);
+}
+
+// The db keeps its tree in step with writes and deletes
+static void db_merkle_follows_writes() {
+    SqliteDb db;
+    open_fresh(db);
+    MerkleTree expected;
+    for (int i = 0; i < 50; i++) {
+        ShoppingList list(list_id(i), "n");
+        db.write(list);
+        expected.update(list.getUid(), list.digest());
+    }
+    db.delete_list(list_id(7));
+    expected.remove(list_id(7));
+    CHECK(db.merkle().root() == expected.root());
+
+    size_t visited = 0;
+    CHECK(descend(db.merkle(), expected, visited).empty());
+}
+
+int main() {
+    read_many_keeps_request_order();
+    read_changed_since_pages_through_every_change();
+    merkle_descent_finds_divergent_lists();
+    db_merkle_follows_writes();
+
+    for (const char* suffix : {"", "-wal", "-shm"})
+        std::remove((DB_PATH + suffix).c_str());
+
+    if (failures) {
+        std::cerr << failures << " db check(s) failed\n";
+        return 1;
+    }
+    std::cout << "db checks passed\n";
+    return 0;
+}
@@ -0,0 +1,111 @@
+// Distribution checks for the placement hashes on list uids: no collisions,
+// even buckets, bit avalanche and ring shares that follow shard weights.
+// Build and run with `make check`.
+#include "util.hpp"
+#include "sharding/hash_ring.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond "\n"; \
+            failures++; \
+        } \
+    } while (0)
+
+static const size_t KEYS = 200000;
+
+// Same alphabet and length as API::createUID; seeded so runs are repeatable
+static std::vector<std::string> make_uids(size_t n) {
+    static const char chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> dist(0, 61);
+    std::vector<std::string> uids(n, std::string(32, 'x'));
+    for (auto& uid : uids)
+        for (auto& c : uid) c = chars[dist(rng)];
+    return uids;
+}
+
+static const char* name(HashVersion v) {
+    return v == HashVersion::FNV1A ? "fnv1a" : "wyhash";
+}
+
+static void no_collisions(HashVersion v, const std::vector<std::string>& uids) {
+    std::unordered_set<uint64_t> seen;
+    for (auto& uid : uids) seen.insert(Util::hash(v, uid));
+    printf("%-7s collisions=%zu\n", name(v), uids.size() - seen.size());
+    CHECK(seen.size() == uids.size());
+}
+
+// Largest deviation of a bucket from the mean, in percent of the mean
+static void buckets_are_even(HashVersion v, const std::vector<std::string>& uids) {
+    const size_t buckets = 64;
+    std::vector<size_t> counts(buckets);
+    for (auto& uid : uids) counts[Util::hash(v, uid) % buckets]++;
+
+    double mean = double(uids.size()) / buckets;
+    auto [lo, hi] = std::minmax_element(counts.begin(), counts.end());
+    double spread = std::max(mean - *lo, *hi - mean) / mean * 100;
+    printf("%-7s buckets=%zu min=%zu max=%zu spread=%.1f%%\n", name(v), buckets, *lo, *hi, spread);
+    CHECK(spread < 10);
+}
+
+// Changing one character should flip about half of the 64 bits
+static void one_char_avalanches(HashVersion v, const std::vector<std::string>& uids) {
+    const size_t samples = 20000;
+    double flipped = 0;
+    for (size_t i = 0; i < samples; i++) {
+        std::string other = uids[i];
+        other[i % other.size()] ^= 1;
+        flipped += std::popcount(Util::hash(v, uids[i]) ^ Util::hash(v, other));
+    }
+    double avg = flipped / samples;
+    printf("%-7s avg bits flipped=%.2f/64\n", name(v), avg);
+    CHECK(std::abs(avg - 32) < 2);
+}
+
+static void ring_follows_weights(HashVersion v, const std::vector<std::string>& uids) {
+    std::map<int, uint32_t> weights = {{3, 2}};
+    HashRing ring = HashRing::with_shards(4, weights, v);
+    std::map<int, size_t> counts;
+    for (auto& uid : uids) counts[ring.shard_for(uid)]++;
+
+    printf("%-7s ring shares:", name(v));
+    for (int s = 0; s < 4; s++) {
+        double expected = (s == 3 ? 2.0 : 1.0) / 5;
+        double share = double(counts[s]) / uids.size();
+        printf(" %d=%.3f(%.3f)", s, share, expected);
+        // Virtual nodes, not the hash, dominate this error
+        CHECK(std::abs(share - expected) / expected < 0.25);
+    }
+    printf("\n");
+}
+
+int main() {
+    std::vector<std::string> uids = make_uids(KEYS);
+    for (HashVersion v : {HashVersion::WYHASH, HashVersion::FNV1A}) {
+        no_collisions(v, uids);
+        buckets_are_even(v, uids);
+        one_char_avalanches(v, uids);
+        ring_follows_weights(v, uids);
+    }
+
+    if (failures) {
+        std::cerr << failures << " hash check(s) failed\n";
+        return 1;
+    }
+    std::cout << "Hash checks passed\n";
+    return 0;
+}
@@ -0,0 +1,210 @@
+// Behaviour checks for ORSet merge, remove and decoding of older encodings.
+// Build and run with `make check`.
+#include "crdt/or_set.hpp"
+
+#include <iostream>
+#include <string>
+
+struct Item {
+    string uid;
+    int version = 0;
+
+    string getUid() const { return uid; }
+
+    bool merge(const Item& other) {
+        if (other.version <= version) return false;
+        version = other.version;
+        return true;
+    }
+
+    uint64_t digest() const { return Util::hash64(uid) + version; }
+
+    MSGPACK_DEFINE(uid, version);
+};
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond "\n"; \
+            failures++; \
+        } \
+    } while (0)
+
+static void sync(ORSet<Item>& a, ORSet<Item>& b) {
+    a.merge(b);
+    b.merge(a);
+}
+
+static void add_is_replicated() {
+    ORSet<Item> a, b;
+    a.add("A", Item{"x", 1});
+
+    CHECK(b.merge(a));
+    CHECK(b.contains("x"));
+    CHECK(!b.merge(a)); // idempotent
+    CHECK(a.digest() == b.digest());
+}
+
+static void observed_remove_is_replicated() {
+    ORSet<Item> a, b;
+    a.add("A", Item{"x", 1});
+    sync(a, b);
+
+    b.remove(Item{"x"});
+    CHECK(!b.contains("x"));
+    CHECK(a.merge(b));
+    CHECK(!a.contains("x"));
+    CHECK(a.digest() == b.digest());
+}
+
+static void concurrent_add_wins_over_remove() {
+    ORSet<Item> a, b;
+    a.add("A", Item{"x", 1});
+    sync(a, b);
+
+    b.remove(Item{"x"});
+    a.add("A", Item{"x", 2}); // re-add not yet seen by b
+    sync(a, b);
+
+    CHECK(a.contains("x"));
+    CHECK(b.contains("x"));
+    CHECK(a.find("x") && a.find("x")->version == 2);
+    CHECK(a.digest() == b.digest());
+}
+
+// Both replicas issue their first add of the same element. Tags carry the
+// replica, so removing the local add must not also cancel the remote one.
+static void concurrent_first_adds_stay_distinct() {
+    ORSet<Item> a, b;
+    a.add("A", Item{"x", 1});
+    b.add("B", Item{"x", 1});
+
+    a.remove(Item{"x"});
+    sync(a, b);
+
+    CHECK(a.contains("x"));
+    CHECK(b.contains("x"));
+}
+
+static void merge_commutes() {
+    ORSet<Item> a, b, c;
+    a.add("A", Item{"x", 1});
+    b.add("B", Item{"y", 1});
+    c.add("C", Item{"z", 1});
+    c.remove(Item{"z"});
+
+    ORSet<Item> left = a, right = c;
+    left.merge(b);
+    left.merge(c);
+    right.merge(b);
+    right.merge(a);
+    CHECK(left.digest() == right.digest());
+    CHECK(left.contains("x") && left.contains("y") && !left.contains("z"));
+}
+
+// Removing drops the element and its dot; only the context's counter moves,
+// so the set is no larger than before the add.
+static void remove_leaves_no_tombstone() {
+    ORSet<Item> a;
+    a.add("A", Item{"y", 1});
+    size_t before = a.approx_size();
+
+    a.add("A", Item{"x", 1});
+    a.remove(Item{"x"});
+    CHECK(!a.contains("x"));
+    CHECK(a.approx_size() == before);
+}
+
+static void stale_copy_does_not_resurrect() {
+    ORSet<Item> a, b;
+    a.add("A", Item{"x", 1});
+    a.add("A", Item{"y", 1});
+    sync(a, b);
+
+    ORSet<Item> stale = b; // still holds the add of x
+    a.remove(Item{"x"});
+
+    CHECK(!a.merge(stale));
+    CHECK(!a.contains("x"));
+    CHECK(a.contains("y"));
+
+    // The stale replica learns of the remove on merge
+    CHECK(b.merge(a));
+    CHECK(!b.contains("x"));
+    CHECK(a.digest() == b.digest());
+}
+
+static ORSet<Item> decode(const msgpack::sbuffer& buf) {
+    msgpack::object_handle oh = msgpack::unpack(buf.data(), buf.size());
+    return oh.get().as<ORSet<Item>>();
+}
+
+static void packed_set_round_trips() {
+    ORSet<Item> a;
+    a.add("A", Item{"x", 1});
+    a.add("A", Item{"y", 2});
+    a.remove(Item{"x"});
+
+    msgpack::sbuffer buf;
+    msgpack::pack(buf, a);
+    ORSet<Item> b = decode(buf);
+    CHECK(b.contains("y") && !b.contains("x"));
+    CHECK(a.digest() == b.digest());
+}
+
+// Sets packed before the format version: elements, add and remove tags
+static void legacy_string_tags_decode() {
+    unordered_map<string, Item> elements{{"x", Item{"x", 1}}, {"y", Item{"y", 1}}};
+    unordered_map<string, unordered_set<string>> added{{"x", {"10", "11"}}, {"y", {"12"}}};
+    unordered_map<string, unordered_set<string>> removed{{"x", {"10"}}, {"y", {"12"}}};
+    msgpack::sbuffer buf;
+    msgpack::pack(buf, msgpack::type::make_tuple(elements, added, removed));
+
+    ORSet<Item> a = decode(buf), b = decode(buf);
+    CHECK(a.contains("x") && !a.contains("y"));
+    CHECK(a.digest() == b.digest()); // replicas convert to the same dots
+
+    b.remove(Item{"x"});
+    CHECK(a.merge(b));
+    CHECK(!a.contains("x"));
+}
+
+static void legacy_dot_tags_decode() {
+    uint64_t r = Dot::replica_id("A");
+    unordered_map<string, Item> elements{{"x", Item{"x", 1}}, {"y", Item{"y", 1}}};
+    unordered_map<string, unordered_set<Dot>> added{{"x", {Dot{r, 1}}}, {"y", {Dot{r, 2}}}};
+    unordered_map<string, unordered_set<Dot>> removed{{"y", {Dot{r, 2}}}};
+    unordered_map<uint64_t, uint64_t> counters{{r, 2}};
+    msgpack::sbuffer buf;
+    msgpack::pack(buf, msgpack::type::make_tuple(elements, added, removed, counters));
+
+    ORSet<Item> a = decode(buf), b = decode(buf);
+    CHECK(a.contains("x") && !a.contains("y"));
+
+    // New adds continue after the legacy counter, so they are not taken as seen
+    a.add("A", Item{"z", 1});
+    CHECK(b.merge(a));
+    CHECK(b.contains("z"));
+}
+
+int main() {
+    add_is_replicated();
+    observed_remove_is_replicated();
+    concurrent_add_wins_over_remove();
+    concurrent_first_adds_stay_distinct();
+    merge_commutes();
+    remove_leaves_no_tombstone();
+    stale_copy_does_not_resurrect();
+    packed_set_round_trips();
+    legacy_string_tags_decode();
+    legacy_dot_tags_decode();
+
+    if (failures) {
+        std::cerr << failures << " ORSet check(s) failed\n";
+        return 1;
+    }
+    std::cout << "ORSet checks passed\n";
+    return 0;
+}